@@ -16,13 +16,16 @@
   =========================================================================*/
 #include "gdcmAnonymizer.h"
 #include "gdcmAttribute.h"
+#include "gdcmBoxRegion.h"
 #include "gdcmDefs.h"
 #include "gdcmDirectory.h"
 #include "gdcmGlobal.h"
 #include "gdcmIconImageGenerator.h"
 #include "gdcmImageReader.h"
+#include "gdcmImageRegionReader.h"
 #include "gdcmImageWriter.h"
 #include "gdcmReader.h"
+#include "gdcmSequenceOfItems.h"
 #include "gdcmStringFilter.h"
 #include "gdcmSystem.h"
 #include "gdcmWriter.h"
@@ -32,6 +35,9 @@
 
 #include <leptonica/allheaders.h>
 #include <tesseract/baseapi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <dirent.h>
 #include <errno.h>
@@ -40,45 +46,2866 @@
 #include <string>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <filesystem>
+#include <limits>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <pthread.h>
+#include <set>
+#include <sstream>
 #include <stdio.h>
 #include <thread>
 
+// processing options shared by all threads
+struct processingoptions {
+  float confidence = 0.0f;
+  int framewindow = 1;                // number of frames decoded at the same time (bounds the decoder memory, not the output)
+  bool temporal = false;              // detect static overlays in multi-frame images using statistics over all frames
+  unsigned int temporalMinFrames = 3; // fewer frames are processed frame by frame
+  float staticTolerance = 4.0f;       // standard deviation over time of a static pixel
+  int staticContrast = 48;            // edge strength in the temporal mean image of a static text pixel
+  float bandHash = 0.0f;              // size of the border bands (fraction of the image) hashed to skip OCR on unchanged frames
+  int tilesize = 0;                   // larger images are split into tiles of this size that are recognized in parallel
+  int tileOverlap = 100;              // tiles overlap by more than the height of a line of text
+  int maxEngines = 1;                 // number of OCR engines shared by file threads and tiles
+  int ompThreads = 1;                 // OpenMP threads tesseract may use inside each engine
+  int textHeight = 0;                 // frames with larger text are downscaled before OCR so that their text has this height
+  int scaleMargin = 2;                // extra margin around words found in a downscaled frame
+  bool crop = false;                  // OCR only the content islands inside a black surround
+  int cropThreshold = 16;             // pixel values up to this are background
+  int cropGap = 8;                    // content islands are separated by at least this many background rows or columns
+  float usRegionsInside = -1.0f;      // OCR outside the ultrasound regions and this fraction inside of them (negative: off)
+  bool anatomy = false;               // remove the largest bright region (the body) before OCR
+  float anatomyMinFraction = 0.1f;    // smallest body region as fraction of the image
+  bool colorKey = false;              // color images: OCR only the saturated or white annotation layer
+  int colorKeySaturation = 80;        // difference between the largest and smallest color channel of annotation colors
+  int colorKeyWhite = 230;            // all color channels at least this bright are white annotations
+  std::string binarize;               // own binarization before OCR ("otsu", "sauvola", empty for tesseract's own)
+  std::map<std::string, std::string> binarizeByModality; // binarization by modality, "" is the default
+  std::map<std::string, std::string> detectorsByModality; // detector cascade by modality like "gate+proposals+tesseract"
+  std::map<std::string, std::string> ocrProfileByModality; // name of the OCR profile by modality, "" is the default
+  bool proposals = false;             // OCR only regions proposed by a morphological text detector
+  bool layout = false;                // mask all word boxes of the layout analysis, recognize only possible safe list words
+  int seriesLearn = 0;                // after this many full OCR instances of a series only known text regions are OCR'd (0: off)
+  float seriesBand = 0.1f;            // border bands (fraction of the image) that are always OCR'd for known series
+  int seriesRecheck = 10;             // every n-th instance of a known series gets a full OCR again (0: never)
+  std::string templates = "";        // JSON file with text regions learned per device, updated after each run
+  bool templateFast = false;          // mask the template regions of known devices without OCR
+  int templateMinInstances = 3;       // a device template is used after this many instances
+  float templateBand = 0.1f;          // border bands (fraction of the image) OCR'd outside the template regions of known devices
+  std::string cache = "";            // directory of the OCR result cache (empty: off)
+  std::string replay = "";           // mapping JSON (--storemapping) whose boxes are masked without OCR (empty: off)
+  std::string audit = "";            // detection only, the findings of each file are appended to this JSON lines file (empty: off)
+  bool propagate = false;             // search the bitmaps of PHI words of a study in its other instances
+  int mosaic = 0;                     // images up to this size are recognized together in one mosaic image (0: off)
+  int mosaicImages = 64;              // number of images in a mosaic
+  float gate = 0;                     // frames with fewer thin strokes in every band of rows are not OCR'd (0: off)
+  bool paranoid = false;              // lower edge contrast and a quarter of the gate threshold
+};
+
+// rectangular part of an image, x2 and y2 are exclusive
+struct region {
+  int x1, y1, x2, y2;
+};
+
+// what a thread learned about the text positions in the instances of one series
+struct seriesstate {
+  int instances = 0; // instances processed so far
+  int width = 0;
+  int height = 0;
+  std::vector<region> textregions; // union of the regions where text was found
+};
+
 struct threadparams {
   const char **filenames;
   size_t nfiles;
   char *scalarpointer;
   std::string outputdir;
   int thread; // number of the thread
-  float confidence;
+  processingoptions opts;
   bool saveMappings;
   // each thread will store here the study instance uid (original and mapped)
   std::map<std::string, std::string> byThreadStudyInstanceUID;
+  // time spend in OCR by this thread
+  double ocrSeconds = 0;
+  int ocrFrames = 0;
+  int gateSkipped = 0; // frames without text according to the gate
+  int wordsFound = 0;
+  int wordsMasked = 0;
+  int peakThreads = 0; // largest number of threads of the process seen by this thread
+  std::map<std::string, seriesstate> series; // by series instance uid
+};
+
+// summary of a run over all files
+struct runstatistics {
+  double seconds = 0;
+  double ocrSeconds = 0;
+  int ocrFrames = 0;
+  int wordsFound = 0;
+  int wordsMasked = 0;
+};
+
+// a single word detected by the OCR engine, bounding box is in image coordinates
+struct wordbox {
+  std::string word;
+  std::string language;
+  float confidence;
+  bool isFromDictionary;
+  bool isNumeric;
+  int x1, y1, x2, y2;
+};
+
+// information about the current file that is stored with each detected word in the mapping file
+struct fileinfo {
+  std::string filename;
+  std::string sopinstanceuid;
+  std::string seriesinstanceuid;
+  std::string studyinstanceuid;
+  std::string seriesdescription;
+  std::string studydescription;
+  std::string modality;
+};
+
+// words that are never masked
+const std::vector<std::string> safeList = {"Patient", "Name", "Study", "Protocol", "Date", "A", "P", "I", "L", "R", "H"};
+
+// value of a per-modality option, "" is the default for all other modalities
+std::string ModalityOption(const std::map<std::string, std::string> &byModality, const std::string &modality) {
+  std::map<std::string, std::string>::const_iterator it = byModality.find(modality);
+  if (it == byModality.end())
+    it = byModality.find("");
+  return it == byModality.end() ? std::string("") : it->second;
+}
+
+// parse a per-modality option like "CT:sauvola,US:otsu" or just "otsu" (used for all modalities)
+std::map<std::string, std::string> ParseModalityOption(const std::string &arg) {
+  std::map<std::string, std::string> byModality;
+  std::stringstream ss(arg);
+  std::string entry;
+  while (std::getline(ss, entry, ',')) {
+    size_t colon = entry.find(':');
+    if (colon == std::string::npos)
+      byModality[""] = entry;
+    else
+      byModality[entry.substr(0, colon)] = entry.substr(colon + 1);
+  }
+  return byModality;
+}
+
+// join overlapping regions until no two regions overlap anymore
+void MergeRegions(std::vector<region> &regions) {
+  bool merged = true;
+  while (merged) {
+    merged = false;
+    for (size_t i = 0; i < regions.size() && !merged; i++) {
+      for (size_t j = i + 1; j < regions.size(); j++) {
+        if (regions[i].x1 < regions[j].x2 && regions[j].x1 < regions[i].x2 && regions[i].y1 < regions[j].y2 && regions[j].y1 < regions[i].y2) {
+          regions[i].x1 = std::min(regions[i].x1, regions[j].x1);
+          regions[i].y1 = std::min(regions[i].y1, regions[j].y1);
+          regions[i].x2 = std::max(regions[i].x2, regions[j].x2);
+          regions[i].y2 = std::max(regions[i].y2, regions[j].y2);
+          regions.erase(regions.begin() + j);
+          merged = true;
+          break;
+        }
+      }
+    }
+  }
+}
+
+// clip a region to the image, false if nothing is left (boxes from JSON files can be anything)
+bool ClipRegion(region &r, int WIDTH, int HEIGHT) {
+  r.x1 = std::max(0, r.x1);
+  r.y1 = std::max(0, r.y1);
+  r.x2 = std::min(WIDTH, r.x2);
+  r.y2 = std::min(HEIGHT, r.y2);
+  return r.x1 < r.x2 && r.y1 < r.y2;
+}
+
+// regions of words with a margin, overlapping regions are joined
+std::vector<region> WordRegions(const std::vector<wordbox> &words, int WIDTH, int HEIGHT, int margin) {
+  std::vector<region> regions;
+  for (int w = 0; w < words.size(); w++) {
+    region r = {std::max(0, words[w].x1 - margin), std::max(0, words[w].y1 - margin), std::min(WIDTH, words[w].x2 + margin),
+                std::min(HEIGHT, words[w].y2 + margin)};
+    regions.push_back(r);
+  }
+  MergeRegions(regions);
+  return regions;
+}
+
+// turn a 1bpp candidate mask into OCR regions: characters are joined by a dilation, each connected
+// component becomes a region with some margin, tiny components are ignored
+std::vector<region> MaskToRegions(PIX *mask, int WIDTH, int HEIGHT, int dilateX = 15, int dilateY = 5, int margin = 6, int minHeight = 6) {
+  std::vector<region> regions;
+  PIX *joined = pixDilateBrick(NULL, mask, dilateX, dilateY);
+  BOXA *boxa = pixConnComp(joined, NULL, 8);
+  pixDestroy(&joined);
+  if (boxa == NULL)
+    return regions;
+  for (int i = 0; i < boxaGetCount(boxa); i++) {
+    l_int32 x, y, w, h;
+    boxaGetBoxGeometry(boxa, i, &x, &y, &w, &h);
+    if (h < minHeight || w < minHeight)
+      continue;
+    region r;
+    r.x1 = std::max(0, x - margin);
+    r.y1 = std::max(0, y - margin);
+    r.x2 = std::min(WIDTH, x + w + margin);
+    r.y2 = std::min(HEIGHT, y + h + margin);
+    regions.push_back(r);
+  }
+  boxaDestroy(&boxa);
+  MergeRegions(regions);
+  return regions;
+}
+
+// number of pixels covered by a list of non-overlapping regions
+size_t RegionsArea(const std::vector<region> &regions) {
+  size_t area = 0;
+  for (int i = 0; i < regions.size(); i++)
+    area += (size_t)(regions[i].x2 - regions[i].x1) * (regions[i].y2 - regions[i].y1);
+  return area;
+}
+
+// all non-empty intersections between the regions of a and the regions of b
+std::vector<region> IntersectRegions(const std::vector<region> &a, const std::vector<region> &b) {
+  std::vector<region> result;
+  for (int i = 0; i < a.size(); i++) {
+    for (int j = 0; j < b.size(); j++) {
+      region r;
+      r.x1 = std::max(a[i].x1, b[j].x1);
+      r.y1 = std::max(a[i].y1, b[j].y1);
+      r.x2 = std::min(a[i].x2, b[j].x2);
+      r.y2 = std::min(a[i].y2, b[j].y2);
+      if (r.x2 > r.x1 && r.y2 > r.y1)
+        result.push_back(r);
+    }
+  }
+  MergeRegions(result);
+  return result;
+}
+
+// regions in the coordinates of a scaled image (rounded outwards)
+std::vector<region> ScaleRegions(const std::vector<region> &regions, float scale, int WIDTH, int HEIGHT) {
+  std::vector<region> result(regions);
+  for (int i = 0; i < result.size(); i++) {
+    result[i].x1 = std::max(0, (int)floor(result[i].x1 * scale));
+    result[i].y1 = std::max(0, (int)floor(result[i].y1 * scale));
+    result[i].x2 = std::min(WIDTH, (int)ceil(result[i].x2 * scale));
+    result[i].y2 = std::min(HEIGHT, (int)ceil(result[i].y2 * scale));
+  }
+  return result;
+}
+
+// the part of the frame outside of the excluded regions as a list of rectangles, each excluded region
+// is shrunk by inside (fraction of its size) on every side first so that its border is kept
+std::vector<region> ComplementRegions(const std::vector<region> &excluded, int WIDTH, int HEIGHT, float inside) {
+  std::vector<region> shrunk;
+  std::vector<int> xs = {0, WIDTH};
+  std::vector<int> ys = {0, HEIGHT};
+  for (int i = 0; i < excluded.size(); i++) {
+    region r = excluded[i];
+    int dx = (int)(inside * (r.x2 - r.x1));
+    int dy = (int)(inside * (r.y2 - r.y1));
+    r.x1 = std::max(0, r.x1 + dx);
+    r.y1 = std::max(0, r.y1 + dy);
+    r.x2 = std::min(WIDTH, r.x2 - dx);
+    r.y2 = std::min(HEIGHT, r.y2 - dy);
+    if (r.x2 <= r.x1 || r.y2 <= r.y1)
+      continue;
+    shrunk.push_back(r);
+    xs.push_back(r.x1);
+    xs.push_back(r.x2);
+    ys.push_back(r.y1);
+    ys.push_back(r.y2);
+  }
+  std::sort(xs.begin(), xs.end());
+  xs.erase(std::unique(xs.begin(), xs.end()), xs.end());
+  std::sort(ys.begin(), ys.end());
+  ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+
+  // the grid cells of all region borders are either completely inside or outside of an excluded region,
+  // cells in one grid row are joined horizontally and equal strips of consecutive grid rows vertically
+  std::vector<region> result;
+  std::vector<region> previous;
+  for (int yi = 0; yi + 1 < ys.size(); yi++) {
+    std::vector<region> strips;
+    for (int xi = 0; xi + 1 < xs.size(); xi++) {
+      bool covered = false;
+      for (int i = 0; i < shrunk.size() && !covered; i++)
+        covered = xs[xi] >= shrunk[i].x1 && xs[xi + 1] <= shrunk[i].x2 && ys[yi] >= shrunk[i].y1 && ys[yi + 1] <= shrunk[i].y2;
+      if (covered)
+        continue;
+      if (!strips.empty() && strips.back().x2 == xs[xi]) {
+        strips.back().x2 = xs[xi + 1];
+      } else {
+        region r = {xs[xi], ys[yi], xs[xi + 1], ys[yi + 1]};
+        strips.push_back(r);
+      }
+    }
+    for (int s = 0; s < strips.size(); s++) {
+      bool extended = false;
+      for (int p = 0; p < previous.size() && !extended; p++) {
+        if (previous[p].x1 == strips[s].x1 && previous[p].x2 == strips[s].x2 && previous[p].y2 == strips[s].y1) {
+          previous[p].y2 = strips[s].y2;
+          strips[s] = previous[p];
+          previous.erase(previous.begin() + p);
+          extended = true;
+        }
+      }
+    }
+    // strips that did not continue into this grid row are finished
+    result.insert(result.end(), previous.begin(), previous.end());
+    previous = strips;
+  }
+  result.insert(result.end(), previous.begin(), previous.end());
+  return result;
+}
+
+// top, bottom, left and right bands of an image, fraction is the size of a band relative to the image size
+std::vector<region> BorderBands(int WIDTH, int HEIGHT, float fraction) {
+  std::vector<region> bands;
+  const int bh = std::min(HEIGHT / 2, (int)(fraction * HEIGHT));
+  const int bw = std::min(WIDTH / 2, (int)(fraction * WIDTH));
+  if (bh > 0) {
+    bands.push_back({0, 0, WIDTH, bh});
+    bands.push_back({0, HEIGHT - bh, WIDTH, HEIGHT});
+  }
+  if (bw > 0 && HEIGHT - 2 * bh > 0) {
+    bands.push_back({0, bh, bw, HEIGHT - bh});
+    bands.push_back({WIDTH - bw, bh, WIDTH, HEIGHT - bh});
+  }
+  return bands;
+}
+
+// text regions of a device, the key is manufacturer, model, software version and image size
+struct devicetemplate {
+  int instances = 0;
+  std::vector<region> regions;
+  std::vector<int> hits; // number of instances with text in each region
+
+  // regions seen in at least minHits instances, text seen once is not masked blindly
+  std::vector<region> Confirmed(int minHits) const {
+    std::vector<region> confirmed;
+    for (int i = 0; i < regions.size(); i++)
+      if (hits[i] >= minHits)
+        confirmed.push_back(regions[i]);
+    return confirmed;
+  }
+};
+
+// device templates shared by all threads, read before and written after a run
+struct templatelibrary {
+  std::mutex lock;
+  std::map<std::string, devicetemplate> devices;
+  bool broken = false; // the file could not be parsed, it is not overwritten
+
+  bool Load(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file.is_open())
+      return false; // starts empty
+    std::lock_guard<std::mutex> guard(lock);
+    try {
+      nlohmann::json library;
+      file >> library;
+      for (auto &entry : library.items()) {
+        devicetemplate t;
+        t.instances = entry.value().value("instances", 0);
+        for (auto &r : entry.value()["regions"]) {
+          t.regions.push_back({r[0].get<int>(), r[1].get<int>(), r[2].get<int>(), r[3].get<int>()});
+          t.hits.push_back(r.size() > 4 ? r[4].get<int>() : t.instances); // older files have no hit count
+        }
+        devices[entry.key()] = t;
+      }
+    } catch (...) {
+      fprintf(stderr, "Error: could not parse device templates \"%s\"\n", filename.c_str());
+      broken = true;
+      return false;
+    }
+    return true;
+  }
+
+  bool Save(const std::string &filename) {
+    std::lock_guard<std::mutex> guard(lock);
+    nlohmann::json library = nlohmann::json::object();
+    for (std::map<std::string, devicetemplate>::const_iterator it = devices.begin(); it != devices.end(); ++it) {
+      nlohmann::json regions = nlohmann::json::array();
+      for (int i = 0; i < it->second.regions.size(); i++) {
+        const region &r = it->second.regions[i];
+        regions.push_back({r.x1, r.y1, r.x2, r.y2, it->second.hits[i]});
+      }
+      library[it->first] = {{"instances", it->second.instances}, {"regions", regions}};
+    }
+    std::ofstream file(filename);
+    file << library.dump(2);
+    return file.good();
+  }
+
+  devicetemplate Get(const std::string &key) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, devicetemplate>::const_iterator it = devices.find(key);
+    return it == devices.end() ? devicetemplate() : it->second;
+  }
+
+  // add the regions found in one more instance of a device
+  void Add(const std::string &key, const std::vector<region> &regions) {
+    std::lock_guard<std::mutex> guard(lock);
+    devicetemplate &t = devices[key];
+    t.instances++;
+    std::vector<bool> seen(t.regions.size(), false);
+    for (int j = 0; j < regions.size(); j++) {
+      const region &f = regions[j];
+      int i = 0;
+      for (; i < t.regions.size(); i++) {
+        region &r = t.regions[i];
+        if (f.x1 < r.x2 && r.x1 < f.x2 && f.y1 < r.y2 && r.y1 < f.y2)
+          break;
+      }
+      if (i == t.regions.size()) { // new text region
+        t.regions.push_back(f);
+        t.hits.push_back(0);
+        seen.push_back(false);
+      }
+      region &r = t.regions[i];
+      r = {std::min(r.x1, f.x1), std::min(r.y1, f.y1), std::max(r.x2, f.x2), std::max(r.y2, f.y2)};
+      if (!seen[i]) { // count each region once per instance
+        t.hits[i]++;
+        seen[i] = true;
+      }
+    }
+  }
+};
+templatelibrary templates;
+
+// read the scan areas of an ultrasound image from the SequenceOfUltrasoundRegions (0018,6011), empty if not present
+std::vector<region> UltrasoundRegions(const gdcm::DataSet &ds, int WIDTH, int HEIGHT) {
+  std::vector<region> regions;
+  const gdcm::Tag tsq(0x0018, 0x6011);
+  if (!ds.FindDataElement(tsq))
+    return regions;
+  gdcm::SmartPointer<gdcm::SequenceOfItems> sqi = ds.GetDataElement(tsq).GetValueAsSQ();
+  if (!sqi)
+    return regions;
+  for (size_t i = 1; i <= sqi->GetNumberOfItems(); i++) { // items are numbered starting with 1
+    const gdcm::DataSet &nds = sqi->GetItem(i).GetNestedDataSet();
+    if (!nds.FindDataElement(gdcm::Tag(0x0018, 0x6018)) || !nds.FindDataElement(gdcm::Tag(0x0018, 0x601e)))
+      continue;
+    gdcm::Attribute<0x0018, 0x6018> minx;
+    gdcm::Attribute<0x0018, 0x601a> miny;
+    gdcm::Attribute<0x0018, 0x601c> maxx;
+    gdcm::Attribute<0x0018, 0x601e> maxy;
+    minx.SetFromDataSet(nds);
+    miny.SetFromDataSet(nds);
+    maxx.SetFromDataSet(nds);
+    maxy.SetFromDataSet(nds);
+    region r;
+    r.x1 = std::max(0, (int)minx.GetValue());
+    r.y1 = std::max(0, (int)miny.GetValue());
+    r.x2 = std::min(WIDTH, (int)maxx.GetValue() + 1);
+    r.y2 = std::min(HEIGHT, (int)maxy.GetValue() + 1);
+    if (r.x2 > r.x1 && r.y2 > r.y1)
+      regions.push_back(r);
+  }
+  return regions;
+}
+
+// settings of an OCR engine, named profiles are read from a JSON file and selected per modality
+struct ocrprofile {
+  std::string languages = "eng+nor"; // this requires a nor.traineddata to be in the tessdata directory
+  std::string tessdata = "";         // directory with the models (e.g. tessdata_fast), empty for the compiled in default
+  int oem = tesseract::OEM_DEFAULT;  // engine mode
+  int psm = -1;                      // page segmentation mode (e.g. 11 for sparse text), -1 for tesseract's default
+  int resolution = 70;               // dpi of the images
+  std::map<std::string, std::string> variables; // tesseract variables, e.g. load_system_dawg=0
+};
+std::map<std::string, ocrprofile> ocrprofiles = {{"default", ocrprofile()}};
+
+// read named OCR profiles, a JSON object like {"sparse": {"languages": "eng", "psm": 11, "variables": {"load_system_dawg": "0"}}}
+bool LoadOCRProfiles(const std::string &filename) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    fprintf(stderr, "Error: could not open OCR profiles \"%s\"\n", filename.c_str());
+    return false;
+  }
+  nlohmann::json profiles;
+  try {
+    file >> profiles;
+    for (auto &entry : profiles.items()) {
+      ocrprofile profile;
+      const nlohmann::json &p = entry.value();
+      profile.languages = p.value("languages", profile.languages);
+      profile.tessdata = p.value("tessdata", profile.tessdata);
+      profile.oem = p.value("oem", profile.oem);
+      profile.psm = p.value("psm", profile.psm);
+      profile.resolution = p.value("resolution", profile.resolution);
+      if (p.contains("variables")) {
+        for (auto &v : p["variables"].items())
+          profile.variables[v.key()] = v.value().is_string() ? v.value().get<std::string>() : v.value().dump();
+      }
+      ocrprofiles[entry.key()] = profile;
+      fprintf(stdout, "OCR profile \"%s\": languages %s, oem %d, psm %d, %ld variables\n", entry.key().c_str(), profile.languages.c_str(),
+              profile.oem, profile.psm, profile.variables.size());
+    }
+  } catch (...) {
+    fprintf(stderr, "Error: could not parse OCR profiles \"%s\"\n", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+// resident memory of the process in MB (0 if unknown)
+double ResidentMemoryMB() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0)
+      return atof(line.c_str() + 6) / 1024.0;
+  }
+  return 0;
+}
+
+// number of threads of the process (0 if unknown), shows how many threads tesseract really starts
+int ThreadCount() {
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 8, "Threads:") == 0)
+      return atoi(line.c_str() + 8);
+  }
+  return 0;
+}
+
+// tesseract's parallel loops ask for a fixed number of threads (num_threads clause), omp_set_num_threads does not
+// bound them but the thread limit of the OpenMP runtime does. The runtime reads OMP_THREAD_LIMIT once when the
+// program starts, so the program is started again with the variable set. A limit set by the user is kept.
+void RestartWithThreadLimit(char *argv[], int limit) {
+  std::string value = std::to_string(limit);
+  const char *current = getenv("OMP_THREAD_LIMIT");
+  if (current != NULL) {
+    if (value != current)
+      fprintf(stdout, "Info: OMP_THREAD_LIMIT=%s from the environment is used\n", current);
+    return;
+  }
+#ifdef __linux__
+  setenv("OMP_THREAD_LIMIT", value.c_str(), 1);
+  fprintf(stdout, "restart with OMP_THREAD_LIMIT=%s\n", value.c_str());
+  fflush(stdout);
+  execv("/proc/self/exe", argv);
+  fprintf(stderr, "Warning: could not restart with OMP_THREAD_LIMIT=%s (%s), set it before starting the program\n", value.c_str(),
+          strerror(errno));
+#else
+  fprintf(stdout, "Info: set OMP_THREAD_LIMIT=%s before starting the program to limit the OCR threads\n", value.c_str());
+#endif
+}
+
+// create and initialize a new OCR engine (this loads the language models), NULL if the models cannot be loaded.
+// An engine without models finds no words, images would be written without any mask.
+tesseract::TessBaseAPI *CreateEngine(const ocrprofile &profile) {
+  tesseract::TessBaseAPI *api = new tesseract::TessBaseAPI();
+  // variables like the dictionaries can only be set during Init
+  GenericVector<STRING> names;
+  GenericVector<STRING> values;
+  for (std::map<std::string, std::string>::const_iterator it = profile.variables.begin(); it != profile.variables.end(); ++it) {
+    names.push_back(STRING(it->first.c_str()));
+    values.push_back(STRING(it->second.c_str()));
+  }
+  if (api->Init(profile.tessdata == "" ? NULL : profile.tessdata.c_str(), profile.languages.c_str(), (tesseract::OcrEngineMode)profile.oem, NULL, 0,
+                &names, &values, false) != 0) {
+    fprintf(stderr, "Error: could not initialize OCR engine for languages %s (tessdata \"%s\")\n", profile.languages.c_str(),
+            profile.tessdata.c_str());
+    api->End();
+    delete api;
+    return NULL;
+  }
+  if (profile.psm >= 0)
+    api->SetPageSegMode((tesseract::PageSegMode)profile.psm);
+  if (profile.resolution > 0)
+    api->SetVariable("user_defined_dpi", std::to_string(profile.resolution).c_str());
+  return api;
+}
+
+// OCR engines shared by all threads, engines are created on demand up to capacity. Each file thread
+// holds one engine, idle engines are borrowed to recognize tiles of large images in parallel. Every
+// engine belongs to one OCR profile.
+struct enginepool {
+  std::mutex lock;
+  std::condition_variable available;
+  std::vector<tesseract::TessBaseAPI *> idle;
+  std::map<tesseract::TessBaseAPI *, std::string> profileOf;
+  int created = 0;
+  double createdMB = 0; // sum of the resident memory added by creating the engines
+  std::mutex creating;  // one engine is created at a time, the memory it adds can be measured
+  int capacity = 1;
+  int busy = 0;    // engines in use
+  int maxBusy = 1; // tile helpers get no engine if this many engines are in use (engines x OCR threads = cores)
+  int threadsPerEngine = 1;
+
+  // OpenMP settings are per thread, every thread that runs an engine calls this first. This bounds only the
+  // parallel regions without their own thread count, OMP_THREAD_LIMIT (RestartWithThreadLimit) bounds all of them.
+  void LimitThreads() {
+#ifdef _OPENMP
+    omp_set_num_threads(threadsPerEngine);
+#endif
+  }
+
+  // get an engine of a profile, waits if all engines are in use. If no more engines can be created an
+  // idle engine of another profile is replaced. NULL if the engine cannot be initialized.
+  tesseract::TessBaseAPI *Acquire(const std::string &profile = "default") {
+    std::unique_lock<std::mutex> guard(lock);
+    available.wait(guard, [this] { return !idle.empty() || created < capacity; });
+    tesseract::TessBaseAPI *api = TakeIdle(profile);
+    if (api != NULL) {
+      busy++;
+      return api;
+    }
+    busy++;
+    tesseract::TessBaseAPI *replaced = NULL;
+    if (created < capacity) {
+      created++;
+    } else {
+      replaced = idle.back();
+      idle.pop_back();
+      profileOf.erase(replaced);
+    }
+    guard.unlock();
+    if (replaced != NULL) {
+      replaced->End();
+      delete replaced;
+    }
+    return Create(profile);
+  }
+
+  // get an engine of a profile only if one is idle or can still be created and fewer than maxBusy engines are
+  // in use, returns NULL otherwise
+  tesseract::TessBaseAPI *TryAcquire(const std::string &profile = "default") {
+    std::unique_lock<std::mutex> guard(lock);
+    if (busy >= maxBusy)
+      return NULL;
+    tesseract::TessBaseAPI *api = TakeIdle(profile);
+    if (api != NULL) {
+      busy++;
+      return api;
+    }
+    if (created >= capacity)
+      return NULL;
+    created++;
+    busy++;
+    guard.unlock();
+    return Create(profile);
+  }
+
+  std::string ProfileOf(tesseract::TessBaseAPI *api) {
+    std::lock_guard<std::mutex> guard(lock);
+    return profileOf[api];
+  }
+
+  // idle engine of a profile (lock is held), NULL if there is none
+  tesseract::TessBaseAPI *TakeIdle(const std::string &profile) {
+    for (int i = idle.size() - 1; i >= 0; i--) {
+      tesseract::TessBaseAPI *api = idle[i];
+      if (profileOf[api] == profile) {
+        idle.erase(idle.begin() + i);
+        return api;
+      }
+    }
+    return NULL;
+  }
+
+  tesseract::TessBaseAPI *Create(const std::string &profile) {
+    std::map<std::string, ocrprofile>::const_iterator it = ocrprofiles.find(profile);
+    std::unique_lock<std::mutex> serial(creating);
+    const double before = ResidentMemoryMB();
+    tesseract::TessBaseAPI *api = CreateEngine(it != ocrprofiles.end() ? it->second : ocrprofile());
+    const double after = ResidentMemoryMB();
+    serial.unlock();
+    if (api == NULL) {
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        created--;
+        busy--;
+      }
+      available.notify_one();
+      return NULL;
+    }
+    fprintf(stdout, "OCR engine for profile \"%s\" created, resident memory %.0f MB (+%.0f MB)\n", profile.c_str(), after, after - before);
+    std::lock_guard<std::mutex> guard(lock);
+    createdMB += after - before;
+    profileOf[api] = profile;
+    return api;
+  }
+
+  void Release(tesseract::TessBaseAPI *api) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      idle.push_back(api);
+      busy--;
+    }
+    available.notify_one();
+  }
+
+  // end all engines, all engines have to be released before
+  void Clear() {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int i = 0; i < idle.size(); i++) {
+      idle[i]->End();
+      delete idle[i];
+    }
+    idle.clear();
+    profileOf.clear();
+    created = 0;
+    createdMB = 0;
+    busy = 0;
+  }
+};
+enginepool engines;
+
+// convert a single frame of pixel data into a 32bit leptonica image for tesseract (NULL if we cannot)
+PIX *FrameToPix(const char *buffer, int WIDTH, int HEIGHT, const gdcm::Image &gimage) {
+  PIX *pixs = pixCreate(WIDTH, HEIGHT, 32); // rgba colors
+  if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::RGB) {
+    if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) { // hopefully always true
+      fprintf(stdout, "We found RGB data with 8bit! HERE\n");
+      /* // we can check if the length is ok
+      if (length > WIDTH * HEIGHT * 3) {
+        length = WIDTH * HEIGHT * 3; // limit the length to what we can read (important for the icon generation for example - prevents floating point error)
+        fprintf(stdout, "SET LENGTH TO %d\n", length);
+      }*/
+      unsigned char *ubuffer = (unsigned char *)buffer;
+      for (int i = 0; i < HEIGHT; i++) {
+        for (int j = 0; j < WIDTH; j++) {
+          l_uint32 val;
+          l_int32 red = 0;
+          l_int32 green = 0;
+          l_int32 blue = 0;
+          // if im is grayscale or color
+          red = ubuffer[(i * WIDTH + j) * 3 + 0];
+          green = ubuffer[(i * WIDTH + j) * 3 + 1];
+          blue = ubuffer[(i * WIDTH + j) * 3 + 2];
+          composeRGBPixel(red, green, blue, &val);
+          pixSetPixel(pixs, j, i, val);
+        }
+      }
+    } else {
+      // color data with not 8bit per channel!
+      fprintf(stderr, "Error: found color data with non-8bit per channel! Unsupported!\n");
+    }
+  } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::MONOCHROME2) {
+    // we can have 8bit or 16bit grayscales here
+    if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) {
+      fprintf(stdout, "We found MONOCHROME2 data with 8bit!\n");
+      unsigned char *ubuffer = (unsigned char *)buffer;
+      for (int i = 0; i < HEIGHT; i++) {
+        for (int j = 0; j < WIDTH; j++) {
+          l_uint32 val;
+          l_int32 red = 0;
+          l_int32 green = 0;
+          l_int32 blue = 0;
+          // if im is grayscale or color
+          red = ubuffer[i * WIDTH + j];
+          green = ubuffer[i * WIDTH + j];
+          blue = ubuffer[i * WIDTH + j];
+          composeRGBPixel(red, green, blue, &val);
+          pixSetPixel(pixs, j, i, val);
+        }
+      }
+    } else if (gimage.GetPixelFormat() == gdcm::PixelFormat::INT16) { // have not seen an example yet
+      short *buffer16 = (short *)buffer;
+      fprintf(stdout, "We found MONOCHROME2 data with 16bit!\n");
+      for (int i = 0; i < HEIGHT; i++) {
+        for (int j = 0; j < WIDTH; j++) {
+          l_uint32 val;
+          l_int32 red = 0;
+          l_int32 green = 0;
+          l_int32 blue = 0;
+          // if im is grayscale or color, PixelRepresentation is 1, so we have signed values ->
+          // 2complement
+          red = (unsigned char)std::min(255, (32768 + buffer16[i * WIDTH + j]) / 255);
+          green = (unsigned char)std::min(255, (32768 + buffer16[i * WIDTH + j]) / 255);
+          blue = (unsigned char)std::min(255, (32768 + buffer16[i * WIDTH + j]) / 255);
+          composeRGBPixel(red, green, blue, &val);
+          pixSetPixel(pixs, j, i, val);
+        }
+      }
+    } else if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT16) { // we have one example that does not work - every
+                                                                       // pixel is 0
+      // pixel representation is 0 -> unsigned short
+      unsigned short *buffer16 = (unsigned short *)buffer;
+      // anything non-zero?
+      for (int i = 0; i < WIDTH * HEIGHT * 2; i++) {
+        if (buffer[i] != 0)
+          fprintf(stdout, "\"%d\" ", (int)(buffer[i]));
+      }
+      fprintf(stdout, "We found MONOCHROME2 data with 16bit (unsigned short %dx%d)!\n", HEIGHT, WIDTH);
+      for (int i = 0; i < HEIGHT; i++) {
+        for (int j = 0; j < WIDTH; j++) {
+          l_uint32 val;
+          l_int32 red = 0;
+          l_int32 green = 0;
+          l_int32 blue = 0;
+          // if im is grayscale or color
+          // fprintf(stdout, "%d %d ", ((unsigned char *)(&buffer16[i * WIDTH + j]))[0],
+          // ((unsigned char *)(&buffer16[i * WIDTH + j]))[1]);
+          int v = floor((((double)buffer16[i * WIDTH + j] - gimage.GetPixelFormat().GetMin()) / (float)gimage.GetPixelFormat().GetMax()) * 255);
+          red = v; // (unsigned char)std::min(255, (buffer16[i * WIDTH + j]) / 255);
+          // if (v != 0)
+          //  fprintf(stdout, "%d (%lld %lld)\n", v, gimage.GetPixelFormat().GetMin(),
+          //  gimage.GetPixelFormat().GetMax());
+          green = v; // (unsigned char)std::min(255, (buffer16[i * WIDTH + j]) / 255);
+          blue = v;  // (unsigned char)std::min(255, (buffer16[i * WIDTH + j]) / 255);
+          composeRGBPixel(red, green, blue, &val);
+          pixSetPixel(pixs, j, i, val);
+        }
+      }
+    } else {
+      fprintf(stderr, "unknown pixel format in input... nothing is done\n");
+    }
+  } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::YBR_FULL_422) {
+    if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) {
+      fprintf(stdout, "Found PhotometricInterpretation YBR_FULL_422 (UINT8)\n");
+      unsigned char *ubuffer = (unsigned char *)buffer;
+      for (int i = 0; i < HEIGHT; i++) {
+        for (int j = 0; j < WIDTH; j++) {
+          l_uint32 val;
+          l_int32 red = 0;
+          l_int32 green = 0;
+          l_int32 blue = 0;
+          // if im is grayscale or color
+          unsigned char a = ubuffer[(i * WIDTH + j) * 3 + 0];
+          unsigned char b = ubuffer[(i * WIDTH + j) * 3 + 1];
+          unsigned char c = ubuffer[(i * WIDTH + j) * 3 + 2];
+
+          int R = 38142 * (a - 16) + 52298 * (c - 128);
+          int G = 38142 * (a - 16) - 26640 * (c - 128) - 12845 * (b - 128);
+          int B = 38142 * (a - 16) + 66093 * (b - 128);
+
+          R = (R + 16384) >> 15;
+          G = (G + 16384) >> 15;
+          B = (B + 16384) >> 15;
+
+          if (R < 0)
+            R = 0;
+          if (G < 0)
+            G = 0;
+          if (B < 0)
+            B = 0;
+          if (R > 255)
+            R = 255;
+          if (G > 255)
+            G = 255;
+          if (B > 255)
+            B = 255;
+          red = R;
+          green = G;
+          blue = B;
+
+          composeRGBPixel(red, green, blue, &val);
+          pixSetPixel(pixs, j, i, val);
+        }
+      }
+    }
+  } else {
+    fprintf(stderr, "Error: cannot process this PhotometricInterpretation.\n");
+    pixDestroy(&pixs);
+    return NULL;
+  }
+  return pixs;
+}
+
+// mask out the bounding box with black in a single frame of pixel data
+void MaskRegion(char *buffer, int WIDTH, int HEIGHT, const gdcm::Image &gimage, int x1, int y1, int x2, int y2) {
+  if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::RGB) {
+    if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) { // hopefully always true
+                                                               // change values in the buffer
+      unsigned char *ubuffer = (unsigned char *)buffer;
+      for (int i = y1; i < y2; i++) {
+        for (int j = x1; j < x2; j++) {
+          ubuffer[(i * WIDTH + j) * 3 + 0] = 0;
+          ubuffer[(i * WIDTH + j) * 3 + 1] = 0;
+          ubuffer[(i * WIDTH + j) * 3 + 2] = 0;
+        }
+      }
+    }
+  } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::MONOCHROME2) {
+    // we can have 8bit or 16bit grayscales here
+    if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) {
+      unsigned char *ubuffer = (unsigned char *)buffer;
+      // fprintf(stdout, "We found MONOCHROME2 data with uint8 8bit!\n");
+      for (int i = y1; i < y2; i++) {
+        for (int j = x1; j < x2; j++) {
+          ubuffer[i * WIDTH + j] = 0;
+        }
+      }
+    } else if (gimage.GetPixelFormat() == gdcm::PixelFormat::INT16) { // have not seen an example yet
+      short *buffer16 = (short *)buffer;
+      // fprintf(stdout, "We found MONOCHROME2 data with 16bit int16!\n");
+      for (int i = y1; i < y2; i++) {
+        for (int j = x1; j < x2; j++) {
+          buffer16[i * WIDTH + j] = 0;
+        }
+      }
+    } else if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT16) { // have not seen an example yet
+      unsigned short *buffer16 = (unsigned short *)buffer;
+      // fprintf(stdout, "We found MONOCHROME2 data with 16bit (unsigned short)!\n");
+      for (int i = y1; i < y2; i++) {
+        for (int j = x1; j < x2; j++) {
+          buffer16[i * WIDTH + j] = 0;
+        }
+      }
+    }
+  } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::YBR_FULL_422) {
+    if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) { // hopefully always true
+                                                               // change values in the buffer
+      unsigned char *ubuffer = (unsigned char *)buffer;        // but buffer has the wrong encoding now
+      for (int i = y1; i < y2; i++) {
+        for (int j = x1; j < x2; j++) { // hope this is ok for YBR data as well
+          ubuffer[(i * WIDTH + j) * 3 + 0] = 0;
+          ubuffer[(i * WIDTH + j) * 3 + 1] = 0;
+          ubuffer[(i * WIDTH + j) * 3 + 2] = 0;
+        }
+      }
+    } else {
+      fprintf(stderr, "ERROR: could not interpret non-UINT8 YBR_FULL_422 data\n");
+    }
+  } else {
+    fprintf(stdout, "Error: unknown data\n");
+  }
+}
+
+// collect the words of the last Recognize call, adds some margin around each bounding box
+void CollectWords(tesseract::TessBaseAPI *api, int WIDTH, int HEIGHT, std::vector<wordbox> &words) {
+  tesseract::ResultIterator *ri = api->GetIterator();
+  tesseract::PageIteratorLevel level = tesseract::RIL_WORD;
+  if (ri != 0) {
+    do {
+      if (ri->Empty(level)) {
+        fprintf(stdout, "ignore this level, its empty\n");
+        continue;
+      }
+      const char *word = ri->GetUTF8Text(level);
+      const char *word_recognition_language = ri->WordRecognitionLanguage();
+      wordbox w;
+      w.word = word ? std::string(word) : std::string("");
+      w.language = word_recognition_language ? std::string(word_recognition_language) : std::string("");
+      w.confidence = ri->Confidence(level);
+      w.isFromDictionary = ri->WordIsFromDictionary();
+      w.isNumeric = ri->WordIsNumeric();
+      ri->BoundingBox(level, &w.x1, &w.y1, &w.x2, &w.y2); // in image coordinates, also if SetRectangle was used
+      // add some margin and make the selection bigger
+      int margin = 2;
+      w.x1 -= margin;
+      w.x2 += margin;
+      w.y1 -= margin;
+      w.y2 += margin;
+      if (w.x1 < 0)
+        w.x1 = 0;
+      if (w.x2 > WIDTH)
+        w.x2 = WIDTH;
+      if (w.y1 < 0)
+        w.y1 = 0;
+      if (w.y2 > HEIGHT)
+        w.y2 = HEIGHT;
+      words.push_back(w);
+      delete[] word;
+    } while (ri->Next(level));
+    delete ri;
+  }
+}
+
+// run the OCR engine on a single frame and return all words with a margin around their bounding box,
+// if regions are provided only those parts of the frame are recognized
+std::vector<wordbox> RecognizeWords(tesseract::TessBaseAPI *api, PIX *pixs, int WIDTH, int HEIGHT, const std::vector<region> *regions = NULL) {
+  std::vector<wordbox> words;
+  api->SetImage(pixs);
+  api->SetSourceResolution(70); // tried several, does not seem to make a different (prevents warning)
+
+  if (regions == NULL) {
+    api->Recognize(0);
+    CollectWords(api, WIDTH, HEIGHT, words);
+    return words;
+  }
+  for (int i = 0; i < regions->size(); i++) {
+    const region &r = (*regions)[i];
+    api->SetRectangle(r.x1, r.y1, r.x2 - r.x1, r.y2 - r.y1);
+    api->Recognize(0);
+    CollectWords(api, WIDTH, HEIGHT, words);
+  }
+  return words;
+}
+
+// Word boxes from the layout analysis only, without running the recognizer. Only boxes that are small enough to
+// contain a word of the safe list are recognized, all other boxes are returned as words without text so that
+// they are always masked. A small box where the recognizer finds nothing is kept as well.
+std::vector<wordbox> LayoutWords(tesseract::TessBaseAPI *api, PIX *pixs, int WIDTH, int HEIGHT, const std::vector<region> *regions = NULL,
+                                 int *numRecognized = NULL) {
+  std::vector<wordbox> words;
+  size_t maxSafeLength = 0;
+  for (int i = 0; i < safeList.size(); i++)
+    maxSafeLength = std::max(maxSafeLength, safeList[i].size());
+
+  std::vector<wordbox> boxes;
+  api->SetImage(pixs);
+  api->SetSourceResolution(70);
+  const int nregions = regions == NULL ? 1 : regions->size();
+  for (int i = 0; i < nregions; i++) {
+    if (regions != NULL) {
+      const region &r = (*regions)[i];
+      api->SetRectangle(r.x1, r.y1, r.x2 - r.x1, r.y2 - r.y1);
+    }
+    tesseract::PageIterator *pi = api->AnalyseLayout();
+    if (pi == NULL)
+      continue;
+    do {
+      if (pi->Empty(tesseract::RIL_WORD))
+        continue;
+      wordbox w;
+      w.confidence = 100.0f; // nothing was recognized, we are sure there is something
+      w.isFromDictionary = false;
+      w.isNumeric = false;
+      pi->BoundingBox(tesseract::RIL_WORD, &w.x1, &w.y1, &w.x2, &w.y2);
+      int margin = 2;
+      w.x1 = std::max(0, w.x1 - margin);
+      w.y1 = std::max(0, w.y1 - margin);
+      w.x2 = std::min(WIDTH, w.x2 + margin);
+      w.y2 = std::min(HEIGHT, w.y2 + margin);
+      boxes.push_back(w);
+    } while (pi->Next(tesseract::RIL_WORD));
+    delete pi;
+  }
+
+  int recognized = 0;
+  for (int i = 0; i < boxes.size(); i++) {
+    const wordbox &b = boxes[i];
+    // characters are at most about as wide as the box is high
+    if (b.x2 - b.x1 > (int)maxSafeLength * (b.y2 - b.y1)) {
+      words.push_back(b);
+      continue;
+    }
+    std::vector<wordbox> boxwords;
+    api->SetRectangle(b.x1, b.y1, b.x2 - b.x1, b.y2 - b.y1);
+    api->Recognize(0);
+    CollectWords(api, WIDTH, HEIGHT, boxwords);
+    recognized++;
+    if (boxwords.size() == 0)
+      words.push_back(b);
+    else
+      words.insert(words.end(), boxwords.begin(), boxwords.end());
+  }
+  if (numRecognized != NULL)
+    *numRecognized = recognized;
+  return words;
+}
+
+// Recognize a list of regions of a frame with SetRectangle. The calling thread works with its own engine and borrows
+// idle engines from the pool for helper threads (never waits for an engine), each engine gets the image once.
+std::vector<wordbox> RecognizeRegionsParallel(tesseract::TessBaseAPI *api, PIX *pixs, int WIDTH, int HEIGHT, const std::vector<region> &regions,
+                                              int *numHelpers = NULL) {
+  std::vector<wordbox> words;
+  std::mutex wordslock;
+  std::atomic<int> next(0);
+  auto work = [&](tesseract::TessBaseAPI *engine) {
+    int t;
+    bool haveImage = false;
+    while ((t = next++) < (int)regions.size()) {
+      if (!haveImage) {
+        engine->SetImage(pixs);
+        engine->SetSourceResolution(70);
+        haveImage = true;
+      }
+      const region &r = regions[t];
+      engine->SetRectangle(r.x1, r.y1, r.x2 - r.x1, r.y2 - r.y1);
+      engine->Recognize(0);
+      std::vector<wordbox> regionwords;
+      CollectWords(engine, WIDTH, HEIGHT, regionwords);
+      std::lock_guard<std::mutex> guard(wordslock);
+      words.insert(words.end(), regionwords.begin(), regionwords.end());
+    }
+  };
+  const std::string profile = engines.ProfileOf(api);
+  auto helper = [&]() {
+    tesseract::TessBaseAPI *engine = engines.TryAcquire(profile);
+    if (engine == NULL)
+      return;
+    engines.LimitThreads();
+    work(engine);
+    engines.Release(engine);
+  };
+  std::vector<std::thread> helpers;
+  for (int i = 1; i < regions.size() && i < engines.maxBusy; i++)
+    helpers.push_back(std::thread(helper));
+  work(api);
+  for (int i = 0; i < helpers.size(); i++)
+    helpers[i].join();
+  if (numHelpers != NULL)
+    *numHelpers = helpers.size();
+  return words;
+}
+
+// keep only one word for text that was found twice in the overlap of two tiles, a box that is mostly
+// inside a larger box is removed
+void DeduplicateWords(std::vector<wordbox> &words) {
+  std::sort(words.begin(), words.end(), [](const wordbox &a, const wordbox &b) { return (a.x2 - a.x1) * (a.y2 - a.y1) > (b.x2 - b.x1) * (b.y2 - b.y1); });
+  std::vector<wordbox> kept;
+  for (int i = 0; i < words.size(); i++) {
+    const wordbox &w = words[i];
+    int area = std::max(1, (w.x2 - w.x1) * (w.y2 - w.y1));
+    bool duplicate = false;
+    for (int j = 0; j < kept.size() && !duplicate; j++) {
+      int ix = std::min(w.x2, kept[j].x2) - std::max(w.x1, kept[j].x1);
+      int iy = std::min(w.y2, kept[j].y2) - std::max(w.y1, kept[j].y1);
+      if (ix > 0 && iy > 0 && ix * iy >= 0.7 * area)
+        duplicate = true;
+    }
+    if (!duplicate)
+      kept.push_back(w);
+  }
+  words.swap(kept);
+}
+
+// split a large frame into overlapping tiles and recognize them in parallel
+std::vector<wordbox> RecognizeWordsTiled(tesseract::TessBaseAPI *api, PIX *pixs, int WIDTH, int HEIGHT, int tilesize, int overlap) {
+  std::vector<region> tiles;
+  const int step = std::max(1, tilesize - overlap);
+  for (int y = 0; y < HEIGHT; y += step) {
+    for (int x = 0; x < WIDTH; x += step) {
+      region r;
+      r.x1 = x;
+      r.y1 = y;
+      r.x2 = std::min(WIDTH, x + tilesize);
+      r.y2 = std::min(HEIGHT, y + tilesize);
+      tiles.push_back(r);
+      if (r.x2 == WIDTH)
+        break;
+    }
+    if (std::min(HEIGHT, y + tilesize) == HEIGHT)
+      break;
+  }
+
+  int helpers = 0;
+  std::vector<wordbox> words = RecognizeRegionsParallel(api, pixs, WIDTH, HEIGHT, tiles, &helpers);
+  DeduplicateWords(words);
+  fprintf(stdout, "tiled OCR: %ld tiles of %dx%d, %d helper threads, %ld words\n", tiles.size(), tilesize, tilesize, helpers, words.size());
+  return words;
+}
+
+// rows (or columns) that contain content, runs separated by less than minGap empty entries are joined
+std::vector<std::pair<int, int>> OccupiedRuns(const std::vector<unsigned char> &occupied, int minGap) {
+  std::vector<std::pair<int, int>> runs;
+  const int n = occupied.size();
+  for (int i = 0; i < n; i++) {
+    if (!occupied[i])
+      continue;
+    int end = i;
+    while (end < n && occupied[end])
+      end++;
+    if (!runs.empty() && i - runs.back().second < minGap)
+      runs.back().second = end;
+    else
+      runs.push_back(std::pair<int, int>(i, end));
+    i = end;
+  }
+  return runs;
+}
+
+// find the rectangular islands of non-background content in a frame, background is every pixel with all color
+// channels at or below threshold (black surround). Islands are separated by at least minGap empty rows or columns.
+std::vector<region> ContentRegions(PIX *pixs, int threshold, int minGap, int margin = 4) {
+  const int w = pixGetWidth(pixs);
+  const int h = pixGetHeight(pixs);
+  const int wpl = pixGetWpl(pixs);
+  l_uint32 *data = pixGetData(pixs);
+
+  // foreground map, branch free over the 32bit pixels so the compiler can vectorize it
+  std::vector<unsigned char> fg((size_t)w * h);
+  for (int i = 0; i < h; i++) {
+    const l_uint32 *line = data + i * wpl;
+    unsigned char *f = &fg[(size_t)i * w];
+    for (int j = 0; j < w; j++) {
+      const l_uint32 v = line[j];
+      const l_uint32 m = std::max(std::max(v >> 24, (v >> 16) & 0xff), (v >> 8) & 0xff);
+      f[j] = m > (l_uint32)threshold;
+    }
+  }
+  std::vector<unsigned char> rows(h, 0);
+  for (int i = 0; i < h; i++) {
+    const unsigned char *f = &fg[(size_t)i * w];
+    unsigned char any = 0;
+    for (int j = 0; j < w; j++)
+      any |= f[j];
+    rows[i] = any;
+  }
+
+  std::vector<region> regions;
+  std::vector<std::pair<int, int>> rowruns = OccupiedRuns(rows, minGap);
+  std::vector<unsigned char> cols(w);
+  for (int r = 0; r < rowruns.size(); r++) {
+    std::fill(cols.begin(), cols.end(), 0);
+    for (int i = rowruns[r].first; i < rowruns[r].second; i++) {
+      const unsigned char *f = &fg[(size_t)i * w];
+      for (int j = 0; j < w; j++)
+        cols[j] |= f[j];
+    }
+    std::vector<std::pair<int, int>> colruns = OccupiedRuns(cols, minGap);
+    for (int c = 0; c < colruns.size(); c++) {
+      // the rows of this column run can be fewer than the rows of the whole band
+      int y1 = rowruns[r].second, y2 = rowruns[r].first;
+      for (int i = rowruns[r].first; i < rowruns[r].second; i++) {
+        const unsigned char *f = &fg[(size_t)i * w];
+        unsigned char any = 0;
+        for (int j = colruns[c].first; j < colruns[c].second; j++)
+          any |= f[j];
+        if (any) {
+          y1 = std::min(y1, i);
+          y2 = i + 1;
+        }
+      }
+      if (y2 - y1 < 3 || colruns[c].second - colruns[c].first < 3) // single noise pixels
+        continue;
+      region reg;
+      reg.x1 = std::max(0, colruns[c].first - margin);
+      reg.y1 = std::max(0, y1 - margin);
+      reg.x2 = std::min(w, colruns[c].second + margin);
+      reg.y2 = std::min(h, y2 + margin);
+      regions.push_back(reg);
+    }
+  }
+  MergeRegions(regions);
+  return regions;
+}
+
+// Extract the burned-in annotations of a color image: pixels with a saturated color (yellow, green, cyan, ...)
+// or pure white are drawn as black text on a white 8bit layer, everything else (the grayscale anatomy) is
+// white. A 1bpp mask of the annotation pixels is returned in mask.
+PIX *ColorKeyLayer(PIX *pixs, int saturation, int white, PIX **mask) {
+  const int w = pixGetWidth(pixs);
+  const int h = pixGetHeight(pixs);
+  const int wpl = pixGetWpl(pixs);
+  l_uint32 *data = pixGetData(pixs);
+  PIX *layer = pixCreate(w, h, 8);
+  const int lwpl = pixGetWpl(layer);
+  l_uint32 *ldata = pixGetData(layer);
+  *mask = pixCreate(w, h, 1);
+  const int mwpl = pixGetWpl(*mask);
+  l_uint32 *mdata = pixGetData(*mask);
+  std::vector<unsigned char> key(w);
+  for (int i = 0; i < h; i++) {
+    const l_uint32 *line = data + i * wpl;
+    unsigned char *k = &key[0];
+    // branch free so the compiler can vectorize the color test
+    for (int j = 0; j < w; j++) {
+      const l_uint32 v = line[j];
+      const int r = v >> 24;
+      const int g = (v >> 16) & 0xff;
+      const int b = (v >> 8) & 0xff;
+      const int mx = std::max(std::max(r, g), b);
+      const int mn = std::min(std::min(r, g), b);
+      k[j] = (mx - mn >= saturation) | (mn >= white);
+    }
+    l_uint32 *lline = ldata + i * lwpl;
+    l_uint32 *mline = mdata + i * mwpl;
+    for (int j = 0; j < w; j++) {
+      SET_DATA_BYTE(lline, j, k[j] ? 0 : 255);
+      if (k[j])
+        SET_DATA_BIT(mline, j);
+    }
+  }
+  return layer;
+}
+
+// Otsu threshold of an 8bit image, optionally returns the fraction of pixels at or below the threshold
+int OtsuThreshold(PIX *pix8, double *fractionBelow = NULL) {
+  const int w = pixGetWidth(pix8);
+  const int h = pixGetHeight(pix8);
+  const int wpl = pixGetWpl(pix8);
+  l_uint32 *data = pixGetData(pix8);
+  double histogram[256] = {0};
+  for (int i = 0; i < h; i++) {
+    l_uint32 *line = data + i * wpl;
+    for (int j = 0; j < w; j++)
+      histogram[GET_DATA_BYTE(line, j)]++;
+  }
+  double total = (double)w * h, sum = 0, sumB = 0, wB = 0, best = -1;
+  for (int t = 0; t < 256; t++)
+    sum += t * histogram[t];
+  int threshold = 128;
+  for (int t = 0; t < 256; t++) {
+    wB += histogram[t];
+    if (wB == 0 || wB == total)
+      continue;
+    sumB += t * histogram[t];
+    double mB = sumB / wB;
+    double mF = (sum - sumB) / (total - wB);
+    double between = wB * (total - wB) * (mB - mF) * (mB - mF);
+    if (between > best) {
+      best = between;
+      threshold = t;
+    }
+  }
+  if (fractionBelow != NULL) {
+    double below = 0;
+    for (int t = 0; t <= threshold; t++)
+      below += histogram[t];
+    *fractionBelow = below / std::max(1.0, total);
+  }
+  return threshold;
+}
+
+// Paint the body region of a CT/MR/CR image black. The body is the largest bright connected component of a
+// quarter resolution Otsu binarization, after an opening that separates text strokes from it. Each row of the
+// component is filled between its first and last pixel (closes holes), minus a border of one coarse pixel.
+// Returns false if there is no body region that covers at least minFraction of the image.
+bool SuppressAnatomy(PIX *pixs, float minFraction) {
+  PIX *pixg = pixConvertRGBToLuminance(pixs);
+  if (pixg == NULL)
+    return false;
+  const int factor = 4;
+  PIX *pixc = pixScaleAreaMap(pixg, 1.0f / factor, 1.0f / factor);
+  pixDestroy(&pixg);
+  if (pixc == NULL)
+    return false;
+  const int w = pixGetWidth(pixc);
+  const int h = pixGetHeight(pixc);
+  const int threshold = OtsuThreshold(pixc);
+  PIX *pixb = pixCreate(w, h, 1);
+  l_uint32 *data = pixGetData(pixc);
+  l_uint32 *bdata = pixGetData(pixb);
+  const int wpl = pixGetWpl(pixc);
+  const int bwpl = pixGetWpl(pixb);
+  for (int i = 0; i < h; i++) {
+    for (int j = 0; j < w; j++) {
+      if (GET_DATA_BYTE(data + i * wpl, j) > threshold)
+        SET_DATA_BIT(bdata + i * bwpl, j);
+    }
+  }
+  pixDestroy(&pixc);
+  PIX *pixo = pixOpenBrick(NULL, pixb, 5, 5);
+  pixDestroy(&pixb);
+  if (pixo == NULL)
+    return false;
+
+  PIXA *pixa = NULL;
+  BOXA *boxa = pixConnComp(pixo, &pixa, 8);
+  pixDestroy(&pixo);
+  int largest = -1;
+  l_int32 largestArea = 0;
+  for (int i = 0; boxa != NULL && i < boxaGetCount(boxa); i++) {
+    l_int32 bx, by, bw, bh, count = 0;
+    boxaGetBoxGeometry(boxa, i, &bx, &by, &bw, &bh);
+    PIX *comp = pixaGetPix(pixa, i, L_CLONE);
+    pixCountPixels(comp, &count, NULL);
+    pixDestroy(&comp);
+    if (count > largestArea) {
+      largestArea = count;
+      largest = i;
+    }
+  }
+  if (largest < 0 || largestArea < minFraction * w * h) {
+    boxaDestroy(&boxa);
+    pixaDestroy(&pixa);
+    return false;
+  }
+  l_int32 bx, by, bw, bh;
+  boxaGetBoxGeometry(boxa, largest, &bx, &by, &bw, &bh);
+  PIX *body = pixaGetPix(pixa, largest, L_CLONE);
+  boxaDestroy(&boxa);
+  pixaDestroy(&pixa);
+
+  const int W = pixGetWidth(pixs);
+  const int H = pixGetHeight(pixs);
+  const int swpl = pixGetWpl(pixs);
+  l_uint32 *sdata = pixGetData(pixs);
+  const int cwpl = pixGetWpl(body);
+  l_uint32 *cdata = pixGetData(body);
+  for (int i = 0; i < bh; i++) {
+    int first = -1, last = -1;
+    for (int j = 0; j < bw; j++) {
+      if (GET_DATA_BIT(cdata + i * cwpl, j)) {
+        if (first < 0)
+          first = j;
+        last = j;
+      }
+    }
+    if (first < 0 || last - first < 2)
+      continue;
+    const int x1 = (bx + first + 1) * factor;
+    const int x2 = std::min(W, (bx + last) * factor);
+    for (int y = (by + i) * factor; y < std::min(H, (by + i + 1) * factor); y++) {
+      l_uint32 *line = sdata + y * swpl;
+      for (int x = x1; x < x2; x++)
+        line[x] = 0;
+    }
+  }
+  pixDestroy(&body);
+  return true;
+}
+
+// Text region proposals from Leptonica morphology: white and black top-hats keep structures thinner than the
+// structuring element (character strokes, a cheap stand-in for a stroke width transform), a horizontal closing joins
+// the characters into words and lines. Components with the geometry of a line of text become candidate regions.
+std::vector<region> ProposeTextRegions(PIX *pixs, int contrast = 40, int strokeSize = 15, int minHeight = 6, int maxHeight = 100) {
+  std::vector<region> regions;
+  PIX *pixg = pixGetDepth(pixs) == 8 ? pixClone(pixs) : pixConvertRGBToLuminance(pixs);
+  if (pixg == NULL)
+    return regions;
+  const int w = pixGetWidth(pixg);
+  const int h = pixGetHeight(pixg);
+  PIX *white = pixTophat(pixg, strokeSize, strokeSize, L_TOPHAT_WHITE);
+  PIX *black = pixTophat(pixg, strokeSize, strokeSize, L_TOPHAT_BLACK);
+  pixDestroy(&pixg);
+  if (white == NULL || black == NULL) {
+    pixDestroy(&white);
+    pixDestroy(&black);
+    return regions;
+  }
+  PIX *mask = pixCreate(w, h, 1);
+  const int twpl = pixGetWpl(white);
+  const int mwpl = pixGetWpl(mask);
+  l_uint32 *wdata = pixGetData(white);
+  l_uint32 *bdata = pixGetData(black);
+  l_uint32 *mdata = pixGetData(mask);
+  for (int i = 0; i < h; i++) {
+    for (int j = 0; j < w; j++) {
+      if (GET_DATA_BYTE(wdata + i * twpl, j) >= contrast || GET_DATA_BYTE(bdata + i * twpl, j) >= contrast)
+        SET_DATA_BIT(mdata + i * mwpl, j);
+    }
+  }
+  pixDestroy(&white);
+  pixDestroy(&black);
+  PIX *lines = pixCloseBrick(NULL, mask, strokeSize, 3);
+  pixDestroy(&mask);
+  if (lines == NULL)
+    return regions;
+  BOXA *boxa = pixConnComp(lines, NULL, 8);
+  pixDestroy(&lines);
+  if (boxa == NULL)
+    return regions;
+  const int margin = 4;
+  for (int i = 0; i < boxaGetCount(boxa); i++) {
+    l_int32 bx, by, bw, bh;
+    boxaGetBoxGeometry(boxa, i, &bx, &by, &bw, &bh);
+    if (bh < minHeight || bh > maxHeight || bw < 0.3 * bh) // not a line of text
+      continue;
+    region r;
+    r.x1 = std::max(0, bx - margin);
+    r.y1 = std::max(0, by - margin);
+    r.x2 = std::min(w, bx + bw + margin);
+    r.y2 = std::min(h, by + bh + margin);
+    regions.push_back(r);
+  }
+  boxaDestroy(&boxa);
+  MergeRegions(regions);
+  return regions;
+}
+
+// Binarize a frame for OCR, Tesseract skips its own thresholding for 1bpp input. The text polarity is taken
+// from the Otsu minority class, white text on black is inverted so that the text is always black (1) on white.
+// Methods are "otsu" (global) and "sauvola" (local mean and standard deviation in a sliding window, computed
+// with running column sums so only a few rows of memory are needed). Returns NULL for an unknown method.
+PIX *BinarizeForOCR(PIX *pixs, const std::string &method, int window = 25, float k = 0.2f, float minStd = 8.0f) {
+  if (method != "otsu" && method != "sauvola")
+    return NULL;
+  PIX *pixg = pixGetDepth(pixs) == 8 ? pixClone(pixs) : pixConvertRGBToLuminance(pixs);
+  if (pixg == NULL)
+    return NULL;
+  const int w = pixGetWidth(pixg);
+  const int h = pixGetHeight(pixg);
+  double below = 0;
+  int threshold = OtsuThreshold(pixg, &below);
+  const bool brightText = below > 0.5;
+  std::vector<unsigned char> gray((size_t)w * h);
+  const int gwpl = pixGetWpl(pixg);
+  l_uint32 *gdata = pixGetData(pixg);
+  for (int i = 0; i < h; i++) {
+    unsigned char *g = &gray[(size_t)i * w];
+    for (int j = 0; j < w; j++)
+      g[j] = GET_DATA_BYTE(gdata + i * gwpl, j);
+    if (brightText) {
+      for (int j = 0; j < w; j++)
+        g[j] = 255 - g[j];
+    }
+  }
+  pixDestroy(&pixg);
+  if (brightText)
+    threshold = 255 - threshold - 1;
+
+  PIX *pixb = pixCreate(w, h, 1);
+  const int bwpl = pixGetWpl(pixb);
+  l_uint32 *bdata = pixGetData(pixb);
+  if (method == "otsu") {
+    for (int i = 0; i < h; i++) {
+      const unsigned char *g = &gray[(size_t)i * w];
+      l_uint32 *bline = bdata + i * bwpl;
+      for (int j = 0; j < w; j++) {
+        if (g[j] <= threshold)
+          SET_DATA_BIT(bline, j);
+      }
+    }
+    return pixb;
+  }
+
+  const int r = window / 2;
+  std::vector<uint32_t> colsum(w, 0);
+  std::vector<uint64_t> colsq(w, 0);
+  std::vector<uint64_t> prefix(w + 1, 0);
+  std::vector<uint64_t> prefixsq(w + 1, 0);
+  auto addRow = [&](int y, int sign) {
+    const unsigned char *g = &gray[(size_t)y * w];
+    for (int j = 0; j < w; j++) {
+      colsum[j] += sign * g[j];
+      colsq[j] += sign * (int64_t)(g[j] * g[j]);
+    }
+  };
+  for (int y = 0; y < std::min(h, r); y++)
+    addRow(y, 1);
+  for (int i = 0; i < h; i++) {
+    if (i + r < h)
+      addRow(i + r, 1);
+    if (i - r - 1 >= 0)
+      addRow(i - r - 1, -1);
+    const int nrows = std::min(h - 1, i + r) - std::max(0, i - r) + 1;
+    for (int j = 0; j < w; j++) {
+      prefix[j + 1] = prefix[j] + colsum[j];
+      prefixsq[j + 1] = prefixsq[j] + colsq[j];
+    }
+    const unsigned char *g = &gray[(size_t)i * w];
+    l_uint32 *bline = bdata + i * bwpl;
+    for (int j = 0; j < w; j++) {
+      const int x0 = std::max(0, j - r);
+      const int x1 = std::min(w - 1, j + r);
+      const float n = (float)((x1 - x0 + 1) * nrows);
+      const float mean = (prefix[x1 + 1] - prefix[x0]) / n;
+      const float var = (prefixsq[x1 + 1] - prefixsq[x0]) / n - mean * mean;
+      const float sd = sqrtf(std::max(0.0f, var));
+      const float t = mean * (1.0f + k * (sd / 128.0f - 1.0f));
+      if (sd >= minStd && g[j] < t) // flat areas are background, prevents speckle noise
+        SET_DATA_BIT(bline, j);
+    }
+  }
+  return pixb;
+}
+
+// a character of a fixed vendor font, the binarized bitmap is stored with zero mean for the correlation
+struct glyph {
+  std::string label;
+  int w, h;
+  std::vector<float> t;
+  float norm; // length of t
+  float ones; // number of text pixels
+};
+
+// all glyphs of one vendor font
+struct glyphfont {
+  std::vector<glyph> glyphs;
+  int minHeight = 0;
+  int maxHeight = 0;
+  int maxWidth = 0;
+};
+
+// glyph fonts by device key prefix (manufacturer|model|software|rows|columns)
+std::map<std::string, glyphfont> glyphfonts;
+
+// 1bpp image as floats (text is 1), the correlation loops can be vectorized on this
+std::vector<float> BinaryToFloat(PIX *binary) {
+  const int w = pixGetWidth(binary);
+  const int h = pixGetHeight(binary);
+  const int wpl = pixGetWpl(binary);
+  l_uint32 *data = pixGetData(binary);
+  std::vector<float> img((size_t)w * h);
+  for (int i = 0; i < h; i++) {
+    l_uint32 *line = data + i * wpl;
+    for (int j = 0; j < w; j++)
+      img[(size_t)i * w + j] = (float)GET_DATA_BIT(line, j);
+  }
+  return img;
+}
+
+// copy a part of a binary image into a glyph, false if the part has no contrast
+bool CropGlyph(const std::vector<float> &img, int WIDTH, int x1, int y1, int w, int h, glyph &g) {
+  g.w = w;
+  g.h = h;
+  g.t.resize((size_t)w * h);
+  g.ones = 0;
+  for (int i = 0; i < h; i++) {
+    for (int j = 0; j < w; j++) {
+      g.t[(size_t)i * w + j] = img[(size_t)(y1 + i) * WIDTH + x1 + j];
+      g.ones += g.t[(size_t)i * w + j];
+    }
+  }
+  const float mean = g.ones / std::max((size_t)1, g.t.size());
+  g.norm = 0;
+  for (int i = 0; i < g.t.size(); i++) {
+    g.t[i] -= mean;
+    g.norm += g.t[i] * g.t[i];
+  }
+  g.norm = sqrt(g.norm);
+  return g.norm > 0;
+}
+
+// read the glyph bitmaps of a font from a directory, the file name is the label ("A.png", "7.png", "A_2.png" for a
+// second variant, names like "colon" or "slash" for characters that cannot be in a file name)
+bool LoadGlyphFont(const std::string &directory, glyphfont &font) {
+  const std::map<std::string, std::string> names = {{"colon", ":"}, {"slash", "/"}, {"dot", "."}, {"dash", "-"}, {"comma", ","},
+                                                    {"percent", "%"}, {"space", " "}, {"star", "*"}, {"backslash", "\\"}};
+  DIR *dir = opendir(directory.c_str());
+  if (dir == NULL)
+    return false;
+  while (auto f = readdir(dir)) {
+    std::string name = f->d_name;
+    if (name.size() < 5 || name.substr(name.size() - 4) != ".png")
+      continue;
+    PIX *pix = pixRead((directory + "/" + name).c_str());
+    if (pix == NULL)
+      continue;
+    PIX *pix8 = pixGetDepth(pix) == 32 ? pixClone(pix) : pixConvertTo8(pix, 0);
+    pixDestroy(&pix);
+    if (pix8 == NULL)
+      continue;
+    PIX *binary = BinarizeForOCR(pix8, "otsu"); // the text is the minority class, as in the frames
+    pixDestroy(&pix8);
+    if (binary == NULL)
+      continue;
+    const int w = pixGetWidth(binary);
+    const int h = pixGetHeight(binary);
+    std::vector<float> img = BinaryToFloat(binary);
+    pixDestroy(&binary);
+    // crop to the bounding box of the character, components of a frame are compared with this size
+    int x1 = w, y1 = h, x2 = -1, y2 = -1;
+    for (int i = 0; i < h; i++) {
+      for (int j = 0; j < w; j++) {
+        if (img[(size_t)i * w + j] > 0) {
+          x1 = std::min(x1, j);
+          y1 = std::min(y1, i);
+          x2 = std::max(x2, j);
+          y2 = std::max(y2, i);
+        }
+      }
+    }
+    if (x2 < x1)
+      continue;
+    glyph g;
+    std::string stem = name.substr(0, name.size() - 4);
+    stem = stem.substr(0, stem.find('_'));
+    g.label = names.count(stem) ? names.at(stem) : stem;
+    CropGlyph(img, w, x1, y1, x2 - x1 + 1, y2 - y1 + 1, g);
+    font.minHeight = font.glyphs.empty() ? g.h : std::min(font.minHeight, g.h);
+    font.maxHeight = std::max(font.maxHeight, g.h);
+    font.maxWidth = std::max(font.maxWidth, g.w);
+    font.glyphs.push_back(g);
+  }
+  closedir(dir);
+  return font.glyphs.size() > 0;
+}
+
+// read the glyph fonts, a JSON object from device key prefix to a directory of glyph bitmaps like
+// {"SIEMENS|ACUSON S2000": "/fonts/acuson"}
+bool LoadGlyphFonts(const std::string &filename) {
+  std::ifstream file(filename);
+  if (!file.is_open()) {
+    fprintf(stderr, "Error: could not open glyph fonts \"%s\"\n", filename.c_str());
+    return false;
+  }
+  try {
+    nlohmann::json fonts;
+    file >> fonts;
+    for (auto &entry : fonts.items()) {
+      glyphfont font;
+      if (!LoadGlyphFont(entry.value().get<std::string>(), font)) {
+        fprintf(stderr, "Error: no glyphs found in \"%s\"\n", entry.value().get<std::string>().c_str());
+        return false;
+      }
+      fprintf(stdout, "glyph font for \"%s\": %ld glyphs, height %d..%d\n", entry.key().c_str(), font.glyphs.size(), font.minHeight,
+              font.maxHeight);
+      glyphfonts[entry.key()] = font;
+    }
+  } catch (...) {
+    fprintf(stderr, "Error: could not parse glyph fonts \"%s\"\n", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+// key of the device that created an image, the text regions of templates and the glyph fonts are stored by this
+std::string DeviceKey(const gdcm::StringFilter &sf) {
+  return sf.ToString(gdcm::Tag(0x0008, 0x0070)) + "|" + sf.ToString(gdcm::Tag(0x0008, 0x1090)) + "|" + sf.ToString(gdcm::Tag(0x0018, 0x1020)) +
+         "|" + std::to_string(atoi(sf.ToString(gdcm::Tag(0x0028, 0x0010)).c_str())) + "|" +
+         std::to_string(atoi(sf.ToString(gdcm::Tag(0x0028, 0x0011)).c_str()));
+}
+
+// glyph font with the longest device key prefix that matches, NULL if there is none
+const glyphfont *FindGlyphFont(const std::string &devicekey) {
+  const glyphfont *font = NULL;
+  size_t longest = 0;
+  for (std::map<std::string, glyphfont>::const_iterator it = glyphfonts.begin(); it != glyphfonts.end(); ++it) {
+    if (devicekey.compare(0, it->first.size(), it->first) == 0 && it->first.size() >= longest) {
+      font = &it->second;
+      longest = it->first.size();
+    }
+  }
+  return font;
+}
+
+// normalized cross-correlation of a glyph with the binary image at x0,y0, the template has zero mean so the mean of
+// the image window drops out of the product, for a binary image the sum of squares is the sum
+float GlyphScore(const float *img, int WIDTH, int x0, int y0, const glyph &g) {
+  float sum = 0, dot = 0;
+  for (int i = 0; i < g.h; i++) {
+    const float *row = img + (size_t)(y0 + i) * WIDTH + x0;
+    const float *t = &g.t[(size_t)i * g.w];
+    for (int j = 0; j < g.w; j++) {
+      sum += row[j];
+      dot += t[j] * row[j];
+    }
+  }
+  const float var = sum - sum * sum / (g.w * g.h);
+  if (var <= 0 || g.norm <= 0)
+    return 0;
+  return dot / (g.norm * sqrt(var));
+}
+
+// words in upper case without anything but letters and digits, detected words and header values are compared like this
+std::string NormalizeWord(const std::string &word) {
+  std::string normalized;
+  for (int i = 0; i < word.size(); i++) {
+    if (isalnum((unsigned char)word[i]))
+      normalized += (char)toupper((unsigned char)word[i]);
+  }
+  return normalized;
+}
+
+// the identifying strings of a file from its header (names, ids, birth date in the usual formats), normalized
+std::set<std::string> PHIStrings(const gdcm::StringFilter &sf) {
+  std::set<std::string> phi;
+  const gdcm::Tag tags[] = {gdcm::Tag(0x0010, 0x0010), gdcm::Tag(0x0010, 0x0020), gdcm::Tag(0x0010, 0x1000),
+                            gdcm::Tag(0x0008, 0x0050), gdcm::Tag(0x0008, 0x0090), gdcm::Tag(0x0010, 0x0030)};
+  for (int t = 0; t < sizeof(tags) / sizeof(tags[0]); t++) {
+    std::string value = sf.ToString(tags[t]);
+    std::replace(value.begin(), value.end(), '^', ' ');
+    std::stringstream ss(value);
+    std::string token;
+    while (ss >> token) {
+      token = NormalizeWord(token);
+      if (token.size() >= 3)
+        phi.insert(token);
+    }
+  }
+  std::string birthdate = NormalizeWord(sf.ToString(gdcm::Tag(0x0010, 0x0030)));
+  if (birthdate.size() == 8) { // YYYYMMDD, also as DD.MM.YYYY and MM/DD/YYYY
+    phi.insert(birthdate.substr(6, 2) + birthdate.substr(4, 2) + birthdate.substr(0, 4));
+    phi.insert(birthdate.substr(4, 2) + birthdate.substr(6, 2) + birthdate.substr(0, 4));
+  }
+  return phi;
+}
+
+// Search the bitmaps of words in a binarized frame. An integral image of the text pixels skips all windows with
+// a different amount of text, only the remaining positions are correlated.
+std::vector<wordbox> FindBitmaps(const std::vector<float> &img, int WIDTH, int HEIGHT, const std::vector<glyph> &bitmaps, float minScore = 0.85f) {
+  std::vector<wordbox> found;
+  if (bitmaps.empty())
+    return found;
+  std::vector<uint32_t> integral((size_t)(WIDTH + 1) * (HEIGHT + 1), 0);
+  for (int i = 0; i < HEIGHT; i++) {
+    uint32_t rowsum = 0;
+    for (int j = 0; j < WIDTH; j++) {
+      rowsum += (uint32_t)img[(size_t)i * WIDTH + j];
+      integral[(size_t)(i + 1) * (WIDTH + 1) + j + 1] = integral[(size_t)i * (WIDTH + 1) + j + 1] + rowsum;
+    }
+  }
+  for (int b = 0; b < bitmaps.size(); b++) {
+    const glyph &g = bitmaps[b];
+    if (g.ones < 10 || g.w > WIDTH || g.h > HEIGHT)
+      continue;
+    const float tolerance = 0.2f * g.ones;
+    for (int y = 0; y + g.h <= HEIGHT; y++) {
+      const uint32_t *top = &integral[(size_t)y * (WIDTH + 1)];
+      const uint32_t *bottom = &integral[(size_t)(y + g.h) * (WIDTH + 1)];
+      for (int x = 0; x + g.w <= WIDTH; x++) {
+        const float ones = (float)(bottom[x + g.w] - bottom[x] - top[x + g.w] + top[x]);
+        if (fabs(ones - g.ones) > tolerance)
+          continue;
+        const float score = GlyphScore(&img[0], WIDTH, x, y, g);
+        if (score < minScore)
+          continue;
+        wordbox w;
+        w.word = g.label;
+        w.language = "bitmap";
+        w.confidence = 100.0f * score;
+        w.isFromDictionary = false;
+        w.isNumeric = false;
+        w.x1 = x;
+        w.y1 = y;
+        w.x2 = x + g.w;
+        w.y2 = y + g.h;
+        found.push_back(w);
+        x += g.w - 1; // no overlapping matches of the same bitmap
+      }
+    }
+  }
+  return found;
+}
+
+// bitmaps of the PHI words found so far by study instance uid, shared by all threads so that the instances of a
+// study benefit even if they are processed by different threads
+struct phibitmapstore {
+  std::mutex lock;
+  std::map<std::string, std::vector<glyph>> studies;
+
+  std::vector<glyph> Get(const std::string &study) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::map<std::string, std::vector<glyph>>::const_iterator it = studies.find(study);
+    return it == studies.end() ? std::vector<glyph>() : it->second;
+  }
+
+  // add the new bitmaps of a study (at most 64), returns how many were not known yet
+  int Add(const std::string &study, const std::vector<glyph> &learned) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<glyph> &bitmaps = studies[study];
+    int added = 0;
+    for (int l = 0; l < learned.size() && bitmaps.size() < 64; l++) {
+      const glyph &g = learned[l];
+      bool duplicate = false;
+      for (int b = 0; b < bitmaps.size() && !duplicate; b++)
+        duplicate = bitmaps[b].label == g.label && bitmaps[b].w == g.w && bitmaps[b].h == g.h;
+      if (!duplicate) {
+        bitmaps.push_back(g);
+        added++;
+      }
+    }
+    return added;
+  }
+};
+phibitmapstore phibitmaps;
+
+// Detect text rendered in a known bitmap font without OCR: connected components of the binarized frame with the size
+// of a glyph are compared with all glyphs of similar size (+-1 pixel shifts), matches next to each other become words.
+std::vector<wordbox> GlyphWords(PIX *pixs, int WIDTH, int HEIGHT, const glyphfont &font, float minScore = 0.8f) {
+  std::vector<wordbox> words;
+  PIX *binary = BinarizeForOCR(pixs, "otsu");
+  if (binary == NULL)
+    return words;
+  PIX *joined = pixCloseBrick(NULL, binary, 1, 5); // dots of i, j and colons belong to their character
+  std::vector<float> img = BinaryToFloat(binary);
+  pixDestroy(&binary);
+  BOXA *boxa = joined != NULL ? pixConnComp(joined, NULL, 8) : NULL;
+  pixDestroy(&joined);
+  if (boxa == NULL)
+    return words;
+
+  std::vector<wordbox> matches;
+  for (int c = 0; c < boxaGetCount(boxa); c++) {
+    l_int32 bx, by, bw, bh;
+    boxaGetBoxGeometry(boxa, c, &bx, &by, &bw, &bh);
+    if (bh < font.minHeight - 2 || bh > font.maxHeight + 2 || bw > font.maxWidth + 2)
+      continue;
+    float best = 0;
+    const glyph *bestGlyph = NULL;
+    int bestX = 0, bestY = 0;
+    for (int k = 0; k < font.glyphs.size(); k++) {
+      const glyph &g = font.glyphs[k];
+      if (abs(g.h - bh) > 2 || abs(g.w - bw) > 2)
+        continue;
+      for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          const int x0 = bx + dx;
+          const int y0 = by + dy;
+          if (x0 < 0 || y0 < 0 || x0 + g.w > WIDTH || y0 + g.h > HEIGHT)
+            continue;
+          float score = GlyphScore(&img[0], WIDTH, x0, y0, g);
+          if (score > best) {
+            best = score;
+            bestGlyph = &g;
+            bestX = x0;
+            bestY = y0;
+          }
+        }
+      }
+    }
+    if (bestGlyph == NULL || best < minScore)
+      continue;
+    wordbox m;
+    m.word = bestGlyph->label;
+    m.language = "glyph";
+    m.confidence = 100.0f * best;
+    m.isFromDictionary = false;
+    m.isNumeric = false;
+    m.x1 = bestX;
+    m.y1 = bestY;
+    m.x2 = bestX + bestGlyph->w;
+    m.y2 = bestY + bestGlyph->h;
+    matches.push_back(m);
+  }
+  boxaDestroy(&boxa);
+
+  // characters on the same line with a gap of less than about half a character height form a word
+  std::sort(matches.begin(), matches.end(), [](const wordbox &a, const wordbox &b) { return a.x1 < b.x1; });
+  std::vector<int> letters;
+  for (int i = 0; i < matches.size(); i++) {
+    const wordbox &m = matches[i];
+    int target = -1;
+    for (int j = 0; j < words.size() && target < 0; j++) {
+      const int overlap = std::min(m.y2, words[j].y2) - std::max(m.y1, words[j].y1);
+      const int gap = m.x1 - words[j].x2;
+      if (overlap >= (m.y2 - m.y1) / 2 && gap >= -1 && gap <= (m.y2 - m.y1) / 2)
+        target = j;
+    }
+    if (target < 0) {
+      words.push_back(m);
+      letters.push_back(1);
+      continue;
+    }
+    wordbox &w = words[target];
+    w.word += m.word;
+    w.confidence += m.confidence;
+    letters[target]++;
+    w.x1 = std::min(w.x1, m.x1);
+    w.y1 = std::min(w.y1, m.y1);
+    w.x2 = std::max(w.x2, m.x2);
+    w.y2 = std::max(w.y2, m.y2);
+  }
+  const int margin = 2;
+  for (int i = 0; i < words.size(); i++) {
+    words[i].confidence /= letters[i];
+    words[i].isNumeric = words[i].word.find_first_not_of("0123456789.,:-/") == std::string::npos;
+    words[i].x1 = std::max(0, words[i].x1 - margin);
+    words[i].y1 = std::max(0, words[i].y1 - margin);
+    words[i].x2 = std::min(WIDTH, words[i].x2 + margin);
+    words[i].y2 = std::min(HEIGHT, words[i].y2 + margin);
+  }
+  fprintf(stdout, "glyphs: %ld characters matched in %ld words\n", matches.size(), words.size());
+  return words;
+}
+
+// estimate the height of the characters in a frame from the connected components of a coarse (half resolution,
+// Otsu threshold) binarization, the text is assumed to be the minority class. Returns 0 if there are not enough
+// character-like components for a reliable estimate.
+int EstimateTextHeight(PIX *pixs) {
+  PIX *pixg = pixConvertRGBToLuminance(pixs);
+  if (pixg == NULL)
+    return 0;
+  PIX *pixc = pixScaleAreaMap(pixg, 0.5, 0.5);
+  pixDestroy(&pixg);
+  if (pixc == NULL)
+    return 0;
+  const int w = pixGetWidth(pixc);
+  const int h = pixGetHeight(pixc);
+  const int wpl = pixGetWpl(pixc);
+  l_uint32 *data = pixGetData(pixc);
+
+  double below = 0;
+  const int threshold = OtsuThreshold(pixc, &below);
+  const bool brightText = below > 0.5;
+
+  PIX *pixb = pixCreate(w, h, 1);
+  l_uint32 *bdata = pixGetData(pixb);
+  const int bwpl = pixGetWpl(pixb);
+  for (int i = 0; i < h; i++) {
+    l_uint32 *line = data + i * wpl;
+    l_uint32 *bline = bdata + i * bwpl;
+    for (int j = 0; j < w; j++) {
+      int v = GET_DATA_BYTE(line, j);
+      if ((v > threshold) == brightText)
+        SET_DATA_BIT(bline, j);
+    }
+  }
+  pixDestroy(&pixc);
+
+  BOXA *boxa = pixConnComp(pixb, NULL, 8);
+  pixDestroy(&pixb);
+  if (boxa == NULL)
+    return 0;
+  std::vector<int> heights;
+  for (int i = 0; i < boxaGetCount(boxa); i++) {
+    l_int32 bx, by, bw, bh;
+    boxaGetBoxGeometry(boxa, i, &bx, &by, &bw, &bh);
+    if (bh < 4 || bh > h / 4) // too small to measure or too large to be a character
+      continue;
+    if (bw < 0.1 * bh || bw > 1.5 * bh) // characters are taller than wide
+      continue;
+    heights.push_back(bh * 2);
+  }
+  boxaDestroy(&boxa);
+  if (heights.size() < 10)
+    return 0;
+  std::nth_element(heights.begin(), heights.begin() + heights.size() / 2, heights.end());
+  return heights[heights.size() / 2];
+}
+
+// detect words in a single frame, downscales the frame first if its text is much larger than what the
+// OCR needs and splits large frames into tiles that are recognized in parallel. If ocrarea is provided
+// (image coordinates) only those parts of the frame are recognized. For color input the annotation
+// layer can be extracted first.
+std::vector<wordbox> DetectWords(tesseract::TessBaseAPI *api, PIX *pixs, int WIDTH, int HEIGHT, const processingoptions &opts,
+                                 const std::vector<region> *ocrarea = NULL, bool color = false) {
+  float scale = 1.0f;
+  if (opts.textHeight > 0) {
+    int textheight = EstimateTextHeight(pixs);
+    if (textheight > opts.textHeight)
+      scale = std::max(0.25f, (float)opts.textHeight / textheight);
+    fprintf(stdout, "estimated text height %d pixel, scale for OCR %.2f\n", textheight, scale);
+  }
+  PIX *input = pixs;
+  if (scale < 0.9f) {
+    input = pixScale(pixs, scale, scale);
+    if (input == NULL) {
+      input = pixs;
+      scale = 1.0f;
+    }
+  } else {
+    scale = 1.0f; // not worth it
+  }
+  const int w = pixGetWidth(input);
+  const int h = pixGetHeight(input);
+
+  std::vector<wordbox> words;
+  // the parts of the frame that need OCR, all of it if restricted is false
+  std::vector<region> regions;
+  bool restricted = false;
+  if (ocrarea != NULL) {
+    regions = ScaleRegions(*ocrarea, scale, w, h);
+    restricted = true;
+  }
+  if (opts.colorKey && color) {
+    // OCR only the saturated (or white) annotation layer where it has content, the grayscale anatomy is gone
+    PIX *mask = NULL;
+    PIX *layer = ColorKeyLayer(input, opts.colorKeySaturation, opts.colorKeyWhite, &mask);
+    std::vector<region> content = MaskToRegions(mask, w, h);
+    pixDestroy(&mask);
+    if (restricted)
+      content = IntersectRegions(regions, content);
+    fprintf(stdout, "color key: %ld annotation regions cover %.0f%% of the frame\n", content.size(), 100.0 * RegionsArea(content) / ((double)w * h));
+    if (content.size() > 0)
+      words = RecognizeWords(api, layer, w, h, &content);
+    pixDestroy(&layer);
+  } else {
+    bool suppressed = false;
+    if (opts.anatomy) {
+      // OCR on a copy with the body region painted black, whatever content is left are the annotations
+      PIX *copy = pixCopy(NULL, input);
+      if (input != pixs)
+        pixDestroy(&input);
+      input = copy;
+      suppressed = SuppressAnatomy(input, opts.anatomyMinFraction);
+      fprintf(stdout, "anatomy suppression: %s\n", suppressed ? "body region removed" : "no body region found");
+    }
+    if (opts.crop || suppressed) {
+      // only the content islands inside the black surround need OCR
+      std::vector<region> content = ContentRegions(input, opts.cropThreshold, opts.cropGap);
+      fprintf(stdout, "crop: %ld content regions cover %.0f%% of the frame\n", content.size(), 100.0 * RegionsArea(content) / ((double)w * h));
+      if (restricted) {
+        regions = IntersectRegions(regions, content);
+      } else if (RegionsArea(content) < 0.9 * w * h) {
+        regions = content;
+        restricted = true;
+      }
+    }
+    if (opts.proposals) {
+      // only the candidate text regions need OCR
+      std::vector<region> candidates = ProposeTextRegions(input);
+      fprintf(stdout, "proposals: %ld candidate text regions cover %.0f%% of the frame\n", candidates.size(),
+              100.0 * RegionsArea(candidates) / ((double)w * h));
+      regions = restricted ? IntersectRegions(regions, candidates) : candidates;
+      restricted = true;
+    }
+    if (opts.binarize != "" && opts.binarize != "none") {
+      PIX *binary = BinarizeForOCR(input, opts.binarize);
+      if (binary != NULL) {
+        if (input != pixs)
+          pixDestroy(&input);
+        input = binary;
+      } else {
+        fprintf(stderr, "Warning: unknown binarization method \"%s\", use tesseract's own\n", opts.binarize.c_str());
+      }
+    }
+    if (opts.layout) {
+      int recognized = 0;
+      words = LayoutWords(api, input, w, h, restricted ? &regions : NULL, &recognized);
+      fprintf(stdout, "layout: %ld word boxes, %d small enough for the safe list were recognized\n", words.size(), recognized);
+    } else if (restricted) {
+      words = RecognizeRegionsParallel(api, input, w, h, regions);
+    } else if (opts.tilesize > 0 && (w > opts.tilesize || h > opts.tilesize)) {
+      words = RecognizeWordsTiled(api, input, w, h, opts.tilesize, opts.tileOverlap);
+    } else {
+      words = RecognizeWords(api, input, w, h);
+    }
+  }
+
+  if (input != pixs)
+    pixDestroy(&input);
+  if (scale < 1.0f) {
+    // back to full resolution, one pixel in the small image covers several pixels here
+    const int margin = (int)ceil(1.0f / scale) + opts.scaleMargin;
+    for (int i = 0; i < words.size(); i++) {
+      words[i].x1 = std::max(0, (int)floor(words[i].x1 / scale) - margin);
+      words[i].y1 = std::max(0, (int)floor(words[i].y1 / scale) - margin);
+      words[i].x2 = std::min(WIDTH, (int)ceil(words[i].x2 / scale) + margin);
+      words[i].y2 = std::min(HEIGHT, (int)ceil(words[i].y2 / scale) + margin);
+    }
+  }
+  return words;
+}
+
+// store a detected word in the thread storage for the mapping file, frame -1 marks words that apply to all frames
+void StoreWord(threadparams *params, const fileinfo &fi, const wordbox &w, int frame, bool masked, int &counter) {
+  // if we store the results we can write them into the thread storage
+  char numObjects[11];
+  snprintf(numObjects, 11, "%04d", counter++);
+  std::string key = fi.sopinstanceuid + "_" + numObjects;
+  nlohmann::json info = nlohmann::json::object();
+  info["word"] = w.word;
+  info["confidence"] = w.confidence;
+  info["word_recognition_language"] = w.language;
+  info["word_is_from_dictionary"] = w.isFromDictionary;
+  info["word_is_number"] = w.isNumeric;
+  info["bounding_box"] = nlohmann::json::object({{"x1", w.x1}, {"y1", w.y1}, {"x2", w.x2}, {"y2", w.y2}});
+  info["frame"] = frame;
+  info["masked"] = masked; // false for words skipped by the filter policy
+  info["SOPInstanceUID"] = fi.sopinstanceuid;
+  info["SeriesInstanceUID"] = fi.seriesinstanceuid;
+  info["StudyInstanceUID"] = fi.studyinstanceuid;
+  info["SeriesDescription"] = fi.seriesdescription;
+  info["StudyDescription"] = fi.studydescription;
+  info["filename"] = fi.filename;
+  std::string value = info.dump();
+
+  params->byThreadStudyInstanceUID.insert(std::pair<std::string, std::string>(key, value)); // should only add this pair once
+}
+
+// filter policy for detected words, returns true if the word should be masked
+bool KeepWord(const threadparams *params, const wordbox &w) {
+  const char *word = w.word.c_str();
+  float conf = w.confidence;
+  // we can check against a safe list here
+  if (std::find(safeList.begin(), safeList.end(), w.word) != safeList.end()) {
+    printf("skip-word: '%s'; \tconf: %.2f; BoundingBox: %d,%d,%d,%d;\n", word, conf, w.x1, w.y1, w.x2, w.y2);
+    return false; // found a safeList entry, don't do anything
+  }
+  // check if the word is a number? But we don't want to see dates either...
+  // check for confidence
+  if (conf < params->opts.confidence) {
+    printf("skip-word - low confidence: '%s'; \tconf: %.2f; BoundingBox: %d,%d,%d,%d;\n", word, conf, w.x1, w.y1, w.x2, w.y2);
+    return false;
+  }
+
+  if (strlen(word) == 1) {
+    printf("skip-word - single character: '%s'; \tconf: %.2f; BoundingBox: %d,%d,%d,%d;\n", word, conf, w.x1, w.y1, w.x2, w.y2);
+    return false;
+  }
+
+  printf("word: '%s';  \tconf: %.2f; BoundingBox: %d,%d,%d,%d;\n", word, conf, w.x1, w.y1, w.x2, w.y2);
+  return true;
+}
+
+// convert a single frame into 8bit luminance, same intensity mapping as FrameToPix
+bool FrameToGray(const char *buffer, int WIDTH, int HEIGHT, const gdcm::Image &gimage, std::vector<unsigned char> &gray) {
+  const size_t npixels = (size_t)WIDTH * HEIGHT;
+  gray.resize(npixels);
+  unsigned char *g = &gray[0];
+  const gdcm::PixelFormat &pf = gimage.GetPixelFormat();
+  if (pf != gdcm::PixelFormat::UINT8 && pf != gdcm::PixelFormat::INT16 && pf != gdcm::PixelFormat::UINT16)
+    return false;
+
+  if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::RGB && pf == gdcm::PixelFormat::UINT8) {
+    const unsigned char *ubuffer = (const unsigned char *)buffer;
+    for (size_t i = 0; i < npixels; i++) // integer weights (77,150,29)/256 keep this loop vectorizable
+      g[i] = (unsigned char)((77 * ubuffer[i * 3 + 0] + 150 * ubuffer[i * 3 + 1] + 29 * ubuffer[i * 3 + 2]) >> 8);
+  } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::YBR_FULL_422 && pf == gdcm::PixelFormat::UINT8) {
+    const unsigned char *ubuffer = (const unsigned char *)buffer;
+    for (size_t i = 0; i < npixels; i++) // the luminance is the Y channel
+      g[i] = ubuffer[i * 3 + 0];
+  } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::MONOCHROME2) {
+    if (pf == gdcm::PixelFormat::UINT8) {
+      memcpy(g, buffer, npixels);
+    } else if (pf == gdcm::PixelFormat::INT16) {
+      const short *buffer16 = (const short *)buffer;
+      for (size_t i = 0; i < npixels; i++)
+        g[i] = (unsigned char)std::min(255, (32768 + buffer16[i]) / 255);
+    } else {
+      const unsigned short *buffer16 = (const unsigned short *)buffer;
+      const float minval = (float)pf.GetMin();
+      const float scale = 255.0f / (float)pf.GetMax();
+      for (size_t i = 0; i < npixels; i++)
+        g[i] = (unsigned char)std::min(255.0f, std::max(0.0f, (buffer16[i] - minval) * scale));
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// per-pixel statistics over all frames of a cine, used to find static overlays
+struct temporalstatistics {
+  std::vector<unsigned char> minval;
+  std::vector<unsigned char> maxval;
+  std::vector<uint32_t> sum;
+  std::vector<uint32_t> sumsq;
+  unsigned int count = 0;
+
+  void Init(size_t npixels) {
+    minval.assign(npixels, 255);
+    maxval.assign(npixels, 0);
+    sum.assign(npixels, 0);
+    sumsq.assign(npixels, 0);
+    count = 0;
+  }
+
+  // streaming update with one more frame, plain loops without branches so the compiler can vectorize them
+  void Add(const unsigned char *gray) {
+    const size_t n = minval.size();
+    unsigned char *mn = &minval[0];
+    unsigned char *mx = &maxval[0];
+    uint32_t *s = &sum[0];
+    uint32_t *s2 = &sumsq[0];
+    for (size_t i = 0; i < n; i++) {
+      const unsigned char v = gray[i];
+      mn[i] = std::min(mn[i], v);
+      mx[i] = std::max(mx[i], v);
+      s[i] += v;
+      s2[i] += (uint32_t)v * v;
+    }
+    count++;
+  }
+
+  // 1bpp mask of pixels that do not change over time (standard deviation below tolerance) and
+  // that have a strong edge towards a neighboring pixel in the temporal mean image
+  PIX *StaticMask(int WIDTH, int HEIGHT, float tolerance, int contrast) const {
+    const size_t n = minval.size();
+    std::vector<unsigned char> mean(n);
+    std::vector<unsigned char> isstatic(n);
+    const float tol2 = tolerance * tolerance;
+    const float invcount = 1.0f / std::max(1u, count);
+    for (size_t i = 0; i < n; i++) {
+      const float m = sum[i] * invcount;
+      const float var = sumsq[i] * invcount - m * m;
+      mean[i] = (unsigned char)m;
+      isstatic[i] = (var <= tol2) && (maxval[i] - minval[i] <= 4 * tolerance);
+    }
+    PIX *mask = pixCreate(WIDTH, HEIGHT, 1);
+    l_uint32 *data = pixGetData(mask);
+    const int wpl = pixGetWpl(mask);
+    for (int i = 0; i < HEIGHT - 1; i++) {
+      const unsigned char *m = &mean[(size_t)i * WIDTH];
+      const unsigned char *s = &isstatic[(size_t)i * WIDTH];
+      l_uint32 *line = data + i * wpl;
+      for (int j = 0; j < WIDTH - 1; j++) {
+        if (!s[j])
+          continue;
+        const int dx = abs((int)m[j] - (int)m[j + 1]);
+        const int dy = abs((int)m[j] - (int)m[j + WIDTH]);
+        if (dx >= contrast || dy >= contrast)
+          SET_DATA_BIT(line, j);
+      }
+    }
+    return mask;
+  }
+};
+
+// Cheap test for burned-in text before OCR: count thin strokes, pairs of strong opposite gradients not more than
+// maxStroke pixels apart along a row, in bands of 32 rows (every other row is used). Text lines give many strokes
+// in one band, smooth anatomy only a few. Returns the largest number of strokes in a band, the largest int if the
+// frame cannot be converted (this never skips OCR).
+int TextScore(const char *buffer, int WIDTH, int HEIGHT, const gdcm::Image &gimage, int edgeThreshold, std::vector<unsigned char> &gray,
+              int maxStroke = 12) {
+  if (!FrameToGray(buffer, WIDTH, HEIGHT, gimage, gray))
+    return std::numeric_limits<int>::max();
+  const int band = 32;
+  int best = 0;
+  for (int b = 0; b < HEIGHT; b += band) {
+    int strokes = 0;
+    for (int i = b; i < std::min(HEIGHT, b + band); i += 2) {
+      const unsigned char *g = &gray[(size_t)i * WIDTH];
+      int lastPos = -maxStroke - 1;
+      int lastSign = 0;
+      for (int j = 0; j < WIDTH - 1; j++) {
+        const int d = (int)g[j + 1] - (int)g[j];
+        if (d >= edgeThreshold || d <= -edgeThreshold) {
+          const int sign = d > 0 ? 1 : -1;
+          if (sign == -lastSign && j - lastPos <= maxStroke)
+            strokes++;
+          lastSign = sign;
+          lastPos = j;
+        }
+      }
+    }
+    best = std::max(best, strokes);
+  }
+  return best;
+}
+
+// a frame of a small image waiting for OCR in a mosaic
+struct mosaictile {
+  std::string filename;
+  unsigned int frame;
+  PIX *pix;
+  int x, y; // position in the mosaic
+};
+
+// words found for the frames of the images that were recognized in a mosaic, by file name and frame
+typedef std::map<std::string, std::vector<std::vector<wordbox>>> mosaicwords;
+
+// OCR many small images at once: the images are packed in rows into one large image with black gutters between
+// them, each word goes back to the image that contains the center of its box (in the coordinates of that image)
+void RecognizeMosaic(tesseract::TessBaseAPI *api, std::vector<mosaictile> &tiles, mosaicwords &batched, int gutter = 32, int maxWidth = 2048) {
+  int x = gutter, y = gutter, rowheight = 0, width = 0;
+  for (int i = 0; i < tiles.size(); i++) {
+    const int w = pixGetWidth(tiles[i].pix);
+    const int h = pixGetHeight(tiles[i].pix);
+    if (x + w + gutter > maxWidth && x > gutter) { // next row
+      x = gutter;
+      y += rowheight + gutter;
+      rowheight = 0;
+    }
+    tiles[i].x = x;
+    tiles[i].y = y;
+    x += w + gutter;
+    rowheight = std::max(rowheight, h);
+    width = std::max(width, x);
+  }
+  const int height = y + rowheight + gutter;
+  PIX *mosaic = pixCreate(width, height, 32);
+  for (int i = 0; i < tiles.size(); i++)
+    pixRasterop(mosaic, tiles[i].x, tiles[i].y, pixGetWidth(tiles[i].pix), pixGetHeight(tiles[i].pix), PIX_SRC, tiles[i].pix, 0, 0);
+  std::vector<wordbox> words = RecognizeWords(api, mosaic, width, height);
+  pixDestroy(&mosaic);
+
+  int routed = 0;
+  for (int i = 0; i < words.size(); i++) {
+    const int cx = (words[i].x1 + words[i].x2) / 2;
+    const int cy = (words[i].y1 + words[i].y2) / 2;
+    for (int j = 0; j < tiles.size(); j++) {
+      const mosaictile &t = tiles[j];
+      const int w = pixGetWidth(t.pix);
+      const int h = pixGetHeight(t.pix);
+      if (cx < t.x || cx >= t.x + w || cy < t.y || cy >= t.y + h)
+        continue;
+      wordbox b = words[i];
+      b.x1 = std::max(0, b.x1 - t.x);
+      b.y1 = std::max(0, b.y1 - t.y);
+      b.x2 = std::min(w, b.x2 - t.x);
+      b.y2 = std::min(h, b.y2 - t.y);
+      batched[t.filename][t.frame].push_back(b);
+      routed++;
+      break;
+    }
+  }
+  fprintf(stdout, "mosaic: %ld images in one %dx%d image, %d words\n", tiles.size(), width, height, routed);
+}
+
+// read the small images of a thread and recognize them together in mosaics, one mosaic per modality, before the
+// files are processed one by one (small images are read twice)
+void BatchSmallImages(threadparams *params, tesseract::TessBaseAPI *&api, mosaicwords &batched,
+                      std::map<std::string, double> &batchedSeconds) {
+  std::map<std::string, std::vector<mosaictile>> pending; // by modality
+  auto flush = [&](const std::string &modality) {
+    std::vector<mosaictile> &tiles = pending[modality];
+    if (tiles.empty())
+      return;
+    std::string profile = ModalityOption(params->opts.ocrProfileByModality, modality);
+    if (profile == "")
+      profile = "default";
+    if (api == NULL || engines.ProfileOf(api) != profile) {
+      if (api != NULL)
+        engines.Release(api);
+      api = engines.Acquire(profile);
+    }
+    if (api == NULL) { // these files are not batched, they fail later one by one
+      for (int i = 0; i < tiles.size(); i++) {
+        batched.erase(tiles[i].filename);
+        pixDestroy(&tiles[i].pix);
+      }
+      tiles.clear();
+      return;
+    }
+    auto ocrstart = std::chrono::steady_clock::now();
+    RecognizeMosaic(api, tiles, batched);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - ocrstart).count();
+    params->ocrSeconds += seconds;
+    params->ocrFrames++;
+    for (int i = 0; i < tiles.size(); i++) // each frame gets its share of the mosaic
+      batchedSeconds[tiles[i].filename] += seconds / tiles.size();
+    for (int i = 0; i < tiles.size(); i++)
+      pixDestroy(&tiles[i].pix);
+    tiles.clear();
+  };
+
+  for (unsigned int file = 0; file < params->nfiles; ++file) {
+    const char *filename = params->filenames[file];
+    // only the header first, most files are too large or need the per-file detection
+    gdcm::ImageRegionReader reader;
+    reader.SetFileName(filename);
+    try {
+      if (!reader.ReadInformation())
+        continue;
+    } catch (...) {
+      continue;
+    }
+    const gdcm::Image &gimage = reader.GetImage();
+    const int WIDTH = gimage.GetDimension(0);
+    const int HEIGHT = gimage.GetDimension(1);
+    if (WIDTH > params->opts.mosaic || HEIGHT > params->opts.mosaic)
+      continue;
+    unsigned int nframes = 1;
+    if (gimage.GetNumberOfDimensions() > 2)
+      nframes = std::max(1u, gimage.GetDimension(2));
+    if (params->opts.temporal && nframes >= params->opts.temporalMinFrames)
+      continue; // static overlays are found over time
+    // images that need more than a plain OCR of the full frame are recognized later one by one
+    gdcm::StringFilter sf;
+    sf.SetFile(reader.GetFile());
+    const std::string modality = sf.ToString(gdcm::Tag(0x0008, 0x0060));
+    const std::string detectors = ModalityOption(params->opts.detectorsByModality, modality);
+    if (params->opts.gate > 0 || (detectors != "" && detectors != "tesseract" && detectors != "glyphs+tesseract") ||
+        params->opts.seriesLearn > 0 || params->opts.templateFast || FindGlyphFont(DeviceKey(sf)) != NULL)
+      continue;
+    // the same for the per-frame steps of DetectWords
+    const std::string binarize = ModalityOption(params->opts.binarizeByModality, modality);
+    const bool tiled = params->opts.tilesize > 0 && (WIDTH > params->opts.tilesize || HEIGHT > params->opts.tilesize);
+    if ((binarize != "" && binarize != "none") || params->opts.crop || params->opts.anatomy || params->opts.colorKey || params->opts.layout ||
+        params->opts.proposals || params->opts.textHeight > 0 || tiled)
+      continue;
+    if (params->opts.usRegionsInside >= 0 && UltrasoundRegions(reader.GetFile().GetDataSet(), WIDTH, HEIGHT).size() > 0)
+      continue;
+    gdcm::BoxRegion box;
+    box.SetDomain(0, WIDTH - 1, 0, HEIGHT - 1, 0, nframes - 1);
+    reader.SetRegion(box);
+    std::vector<char> buffer(reader.ComputeBufferLength());
+    try {
+      if (buffer.size() == 0 || !reader.ReadIntoBuffer(&buffer[0], buffer.size()))
+        continue;
+    } catch (...) {
+      continue;
+    }
+    const size_t framelength = buffer.size() / nframes;
+    std::vector<mosaictile> frames;
+    for (unsigned int z = 0; z < nframes; z++) {
+      mosaictile t;
+      t.filename = filename;
+      t.frame = z;
+      t.pix = FrameToPix(&buffer[z * framelength], WIDTH, HEIGHT, gimage);
+      t.x = t.y = 0;
+      if (t.pix == NULL)
+        break;
+      frames.push_back(t);
+    }
+    if (frames.size() != nframes) { // not supported, recognized later one by one
+      for (int i = 0; i < frames.size(); i++)
+        pixDestroy(&frames[i].pix);
+      continue;
+    }
+    batched[filename].resize(nframes);
+    for (int i = 0; i < frames.size(); i++) {
+      pending[modality].push_back(frames[i]);
+      if (pending[modality].size() >= params->opts.mosaicImages)
+        flush(modality);
+    }
+  }
+  for (std::map<std::string, std::vector<mosaictile>>::iterator it = pending.begin(); it != pending.end(); ++it)
+    flush(it->first);
+}
+
+// fast 64bit hash of a block of memory, reads 8 bytes at a time
+uint64_t HashBytes(const char *data, size_t n, uint64_t h = 0xcbf29ce484222325ULL) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t v;
+    memcpy(&v, data + i, 8);
+    h = (h ^ v) * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 32;
+  }
+  for (; i < n; i++)
+    h = (h ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+// hash of the text-prone parts of a frame: the border bands (fraction of the image size) and the
+// bounding boxes of words found before, only the raw bytes are used so nothing needs to be converted
+uint64_t HashBands(const char *buffer, int WIDTH, int HEIGHT, int pixelsize, float fraction, const std::vector<wordbox> &words) {
+  const size_t rowbytes = (size_t)WIDTH * pixelsize;
+  const int bh = std::min(HEIGHT / 2, (int)(fraction * HEIGHT));
+  const int bw = std::min(WIDTH / 2, (int)(fraction * WIDTH));
+  uint64_t h = HashBytes(buffer, bh * rowbytes);
+  h = HashBytes(buffer + (HEIGHT - bh) * rowbytes, bh * rowbytes, h);
+  for (int i = bh; i < HEIGHT - bh && bw > 0; i++) {
+    h = HashBytes(buffer + i * rowbytes, bw * pixelsize, h);
+    h = HashBytes(buffer + i * rowbytes + (WIDTH - bw) * pixelsize, bw * pixelsize, h);
+  }
+  for (int w = 0; w < words.size(); w++) {
+    for (int i = words[w].y1; i < words[w].y2; i++)
+      h = HashBytes(buffer + i * rowbytes + words[w].x1 * pixelsize, (words[w].x2 - words[w].x1) * pixelsize, h);
+  }
+  return h;
+}
+
+// the settings that change which words are detected in a frame (but not the filter policy applied afterwards)
+std::string DetectionSettings(const processingoptions &opts) {
+  char settings[512];
+  snprintf(settings, sizeof(settings), "%d|%d|%d|%d|%d|%d|%d|%d|%d|%.2f|%d|%d|%d|%s|%.2f|%d|%d|%d", opts.tilesize, opts.textHeight, opts.crop,
+           opts.cropThreshold, opts.cropGap, opts.anatomy, opts.colorKey, opts.colorKeySaturation, opts.colorKeyWhite, opts.usRegionsInside,
+           opts.proposals, opts.layout, opts.temporal, opts.binarize.c_str(), opts.gate, opts.paranoid, opts.scaleMargin, opts.tileOverlap);
+  return std::string(settings);
+}
+
+// the resolved settings of an OCR profile, editing a profile changes the detected words
+std::string ProfileSettings(const std::string &name) {
+  std::map<std::string, ocrprofile>::const_iterator it = ocrprofiles.find(name);
+  const ocrprofile profile = it != ocrprofiles.end() ? it->second : ocrprofile();
+  std::string settings = name + "|" + profile.languages + "|" + profile.tessdata + "|" + std::to_string(profile.oem) + "|" +
+                         std::to_string(profile.psm) + "|" + std::to_string(profile.resolution);
+  for (std::map<std::string, std::string>::const_iterator v = profile.variables.begin(); v != profile.variables.end(); ++v)
+    settings += "|" + v->first + "=" + v->second;
+  return settings;
+}
+
+// the glyphs of a font, adding or changing a font changes the detected words
+std::string GlyphSettings(const glyphfont *font) {
+  if (font == NULL)
+    return "no glyphs";
+  uint64_t h = HashBytes("", 0);
+  for (int i = 0; i < font->glyphs.size(); i++) {
+    const glyph &g = font->glyphs[i];
+    h = HashBytes(g.label.data(), g.label.size(), h);
+    if (!g.t.empty())
+      h = HashBytes((const char *)&g.t[0], g.t.size() * sizeof(float), h);
+  }
+  return std::to_string(font->glyphs.size()) + " glyphs " + std::to_string(h);
+}
+
+// Words detected in a frame (before the filter policy) stored on disk by a hash of the pixel data and the detection
+// settings. A re-run with another confidence or safe list does not need OCR again and identical images hit the
+// cache within a run as well. One JSON file per frame, the first two hex digits of the hash are the sub-directory.
+struct ocrcache {
+  std::string directory;
+  std::mutex lock;
+  std::map<uint64_t, std::vector<wordbox>> memory;
+  int hits = 0;
+  int misses = 0;
+
+  std::string Path(uint64_t key) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long)key);
+    return directory + "/" + std::string(name, 2) + "/" + name + ".json";
+  }
+
+  bool Get(uint64_t key, std::vector<wordbox> &words) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      std::map<uint64_t, std::vector<wordbox>>::const_iterator it = memory.find(key);
+      if (it != memory.end()) {
+        words = it->second;
+        hits++;
+        return true;
+      }
+    }
+    std::ifstream file(Path(key));
+    std::vector<wordbox> cached;
+    bool found = file.is_open();
+    if (found) {
+      try {
+        nlohmann::json ar;
+        file >> ar;
+        for (auto &entry : ar) {
+          wordbox w;
+          w.word = entry["word"].get<std::string>();
+          w.language = entry["language"].get<std::string>();
+          w.confidence = entry["confidence"].get<float>();
+          w.isFromDictionary = entry["dictionary"].get<bool>();
+          w.isNumeric = entry["numeric"].get<bool>();
+          w.x1 = entry["box"][0].get<int>();
+          w.y1 = entry["box"][1].get<int>();
+          w.x2 = entry["box"][2].get<int>();
+          w.y2 = entry["box"][3].get<int>();
+          cached.push_back(w);
+        }
+      } catch (...) {
+        found = false; // broken entry, detect again
+      }
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    if (!found) {
+      misses++;
+      return false;
+    }
+    hits++;
+    memory[key] = cached;
+    words = cached;
+    return true;
+  }
+
+  void Put(uint64_t key, const std::vector<wordbox> &words) {
+    nlohmann::json ar = nlohmann::json::array();
+    for (int i = 0; i < words.size(); i++) {
+      const wordbox &w = words[i];
+      ar.push_back({{"word", w.word},
+                    {"language", w.language},
+                    {"confidence", w.confidence},
+                    {"dictionary", w.isFromDictionary},
+                    {"numeric", w.isNumeric},
+                    {"box", {w.x1, w.y1, w.x2, w.y2}}});
+    }
+    std::string path = Path(key);
+    mkdir(path.substr(0, path.find_last_of('/')).c_str(), 0777);
+    // write to a file of this thread first, other threads never see a partial entry
+    std::string tmp = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    std::ofstream file(tmp);
+    file << ar;
+    file.close();
+    if (!file.good() || rename(tmp.c_str(), path.c_str()) != 0)
+      remove(tmp.c_str());
+    std::lock_guard<std::mutex> guard(lock);
+    memory[key] = words;
+  }
+};
+ocrcache ocrresults;
+
+// boxes of a mapping file written by --storemapping (possibly edited by a reviewer) by SOPInstanceUID, frame -1
+// is every frame of the instance
+struct maskmapping {
+  std::map<std::string, std::vector<std::pair<int, wordbox>>> instances;
+  int boxes = 0;
+
+  bool Load(const std::string &filename) {
+    std::ifstream file(filename);
+    if (!file.is_open())
+      return false;
+    try {
+      nlohmann::json ar;
+      file >> ar;
+      for (auto &entry : ar.items()) {
+        const nlohmann::json &info = entry.value();
+        if (!info.value("masked", true)) // words skipped by the filter policy, reviewers can set them to true
+          continue;
+        std::string uid = info.value("SOPInstanceUID", "");
+        if (uid == "") // the key is the SOPInstanceUID and a counter
+          uid = entry.key().substr(0, entry.key().find_last_of('_'));
+        wordbox w;
+        w.word = info.value("word", "");
+        w.language = info.value("word_recognition_language", "");
+        w.confidence = info.value("confidence", 100.0f);
+        w.isFromDictionary = info.value("word_is_from_dictionary", false);
+        w.isNumeric = info.value("word_is_number", false);
+        const nlohmann::json &bb = info.at("bounding_box");
+        w.x1 = bb.at("x1").get<int>();
+        w.y1 = bb.at("y1").get<int>();
+        w.x2 = bb.at("x2").get<int>();
+        w.y2 = bb.at("y2").get<int>();
+        instances[uid].push_back(std::make_pair(info.value("frame", -1), w));
+        boxes++;
+      }
+    } catch (...) {
+      fprintf(stderr, "Error: could not parse mapping \"%s\"\n", filename.c_str());
+      return false;
+    }
+    return true;
+  }
+};
+maskmapping replaymapping; // read-only while the threads run
+
+// findings of the detection-only audit mode, one JSON object per line as soon as a file is done so that a
+// long survey can be watched (and interrupted) while it runs
+struct auditlog {
+  std::mutex lock;
+  std::ofstream file;
+  int files = 0;
+  int filesWithText = 0;
+  int errors = 0;
+
+  void Write(const nlohmann::json &finding) {
+    std::lock_guard<std::mutex> guard(lock);
+    files++;
+    if (finding["masked"].get<int>() > 0)
+      filesWithText++;
+    if (finding.contains("error"))
+      errors++;
+    file << finding.dump() << "\n";
+    file.flush();
+  }
+
+  // files that could not be read or decoded are listed as well, a survey must not lose them
+  void WriteError(const std::string &filename, const std::string &error) {
+    Write({{"filename", filename}, {"error", error}, {"words", 0}, {"masked", 0}});
+  }
 };
+auditlog audit;
+
+// everything a text detector can use for a frame, stages of a cascade can narrow the regions for later stages
+struct detectorinput {
+  const char *buffer; // raw frame
+  unsigned int frame;
+  int width, height;
+  const gdcm::Image *gimage;
+  const fileinfo *info;
+  const processingoptions *opts;
+  std::string devicekey;
+  bool color;
+  tesseract::TessBaseAPI *api; // OCR engine of this thread
+  std::vector<region> regions; // only these parts of the frame can contain text if restricted
+  bool restricted = false;
+  bool usedEngine = false; // the OCR engine has this frame now
+  bool failed = false;     // the frame cannot be converted
+  PIX *pixs = NULL;
+
+  // the frame as an image, created when a stage needs it
+  PIX *Pix() {
+    if (pixs == NULL && !failed) {
+      pixs = FrameToPix(buffer, width, height, *gimage);
+      failed = pixs == NULL;
+    }
+    return pixs;
+  }
+  ~detectorinput() { pixDestroy(&pixs); }
+};
+
+// a stage of the text detection, adds the words it finds and returns false if later stages should not run
+struct textdetector {
+  virtual ~textdetector() {}
+  virtual std::string Name() const = 0;
+  virtual bool Detect(detectorinput &in, std::vector<wordbox> &words) = 0;
+};
+
+// stops the cascade for frames without thin text-like strokes
+struct gatedetector : textdetector {
+  std::vector<unsigned char> gray;
+  std::string Name() const { return "gate"; }
+  bool Detect(detectorinput &in, std::vector<wordbox> &words) {
+    const float gate = in.opts->gate > 0 ? in.opts->gate : 20.0f;
+    const float threshold = in.opts->paranoid ? gate / 4.0f : gate;
+    const int score = TextScore(in.buffer, in.width, in.height, *in.gimage, in.opts->paranoid ? 20 : 40, gray);
+    const bool needsOCR = score >= threshold;
+    fprintf(stdout, "gate: \"%s\" frame %d score %d threshold %.1f decision %s\n", in.info->filename.c_str(), in.frame, score, threshold,
+            needsOCR ? "ocr" : "skip");
+    return needsOCR;
+  }
+};
+
+// restricts later stages to the candidate text regions, stops if there are none
+struct proposaldetector : textdetector {
+  std::string Name() const { return "proposals"; }
+  bool Detect(detectorinput &in, std::vector<wordbox> &words) {
+    if (in.Pix() == NULL)
+      return false;
+    std::vector<region> candidates = ProposeTextRegions(in.pixs);
+    in.regions = in.restricted ? IntersectRegions(in.regions, candidates) : candidates;
+    in.restricted = true;
+    fprintf(stdout, "proposals: %ld candidate text regions\n", in.regions.size());
+    return in.regions.size() > 0;
+  }
+};
+
+// glyph matching for devices with a known bitmap font, replaces the later stages for frames where glyphs match.
+// Frames without a match go on to the next stage, text in another font could be there.
+struct glyphdetector : textdetector {
+  std::string Name() const { return "glyphs"; }
+  bool Detect(detectorinput &in, std::vector<wordbox> &words) {
+    const glyphfont *font = FindGlyphFont(in.devicekey);
+    if (font == NULL)
+      return true;
+    if (in.Pix() == NULL)
+      return false;
+    std::vector<wordbox> found = GlyphWords(in.pixs, in.width, in.height, *font);
+    words.insert(words.end(), found.begin(), found.end());
+    return found.empty();
+  }
+};
+
+// tesseract with all the options of DetectWords
+struct tesseractdetector : textdetector {
+  std::string Name() const { return "tesseract"; }
+  bool Detect(detectorinput &in, std::vector<wordbox> &words) {
+    if (in.Pix() == NULL)
+      return false;
+    std::vector<wordbox> found = DetectWords(in.api, in.pixs, in.width, in.height, *in.opts, in.restricted ? &in.regions : NULL, in.color);
+    in.usedEngine = true;
+    words.insert(words.end(), found.begin(), found.end());
+    return true;
+  }
+};
+
+// detector by name, NULL for an unknown name
+textdetector *CreateDetector(const std::string &name) {
+  if (name == "gate")
+    return new gatedetector();
+  if (name == "proposals")
+    return new proposaldetector();
+  if (name == "glyphs")
+    return new glyphdetector();
+  if (name == "tesseract")
+    return new tesseractdetector();
+  return NULL;
+}
+
+// the detector cascade of a modality, "gate+proposals+tesseract", the default follows the other options
+std::vector<std::unique_ptr<textdetector>> CreateCascade(const processingoptions &opts, const std::string &modality) {
+  std::string names = ModalityOption(opts.detectorsByModality, modality);
+  if (names == "")
+    names = std::string(opts.gate > 0 ? "gate+" : "") + "glyphs+tesseract";
+  std::vector<std::unique_ptr<textdetector>> cascade;
+  std::stringstream ss(names);
+  std::string name;
+  while (std::getline(ss, name, '+')) {
+    textdetector *detector = CreateDetector(name);
+    if (detector != NULL)
+      cascade.push_back(std::unique_ptr<textdetector>(detector));
+  }
+  return cascade;
+}
+
+// run the stages of a cascade until one of them stops it, returns the stage that stopped (-1 if all stages ran)
+int RunCascade(std::vector<std::unique_ptr<textdetector>> &cascade, detectorinput &in, std::vector<wordbox> &words) {
+  for (int i = 0; i < cascade.size(); i++) {
+    if (!cascade[i]->Detect(in, words))
+      return i;
+  }
+  return -1;
+}
 
 void *ReadFilesThread(void *voidparams) {
   threadparams *params = static_cast<threadparams *>(voidparams);
+  engines.LimitThreads();
+
+  // the OCR engine is expensive to create, do this only once per thread (and again if a file needs another profile)
+  // in replay mode the boxes come from a mapping file and no engine is needed
+  const bool replay = params->opts.replay != "";
+  std::string defaultProfile = ModalityOption(params->opts.ocrProfileByModality, "");
+  tesseract::TessBaseAPI *api = replay ? NULL : engines.Acquire(defaultProfile == "" ? "default" : defaultProfile);
+
+  // small images are recognized together first
+  mosaicwords batched;
+  std::map<std::string, double> batchedSeconds; // OCR time of the batched images by file name
+  if (params->opts.mosaic > 0 && !replay)
+    BatchSmallImages(params, api, batched, batchedSeconds);
 
   const size_t nfiles = params->nfiles;
   for (unsigned int file = 0; file < nfiles; ++file) {
     const char *filename = params->filenames[file];
     // std::cerr << filename << std::endl;
     fprintf(stdout, "Start with %s\n", filename);
+    params->peakThreads = std::max(params->peakThreads, ThreadCount()); // tesseract's OpenMP threads stay alive between files
+    auto filestart = std::chrono::steady_clock::now();
+    const double ocrSecondsBefore = params->ocrSeconds;
+    const int wordsFoundBefore = params->wordsFound;
+    const int wordsMaskedBefore = params->wordsMasked;
+    const bool auditOnly = params->opts.audit != "";
 
-    gdcm::ImageReader reader;
+    // only read the header here, pixel data is decoded later frame by frame (fragment by fragment for encapsulated data)
+    gdcm::ImageRegionReader reader;
     // gdcm::Reader reader;
     reader.SetFileName(filename);
     try {
-      if (!reader.Read()) {
+      if (!reader.ReadInformation()) {
         std::cerr << "Failed to read: \"" << filename << "\" in thread " << params->thread << std::endl;
+        if (auditOnly)
+          audit.WriteError(filename, "could not read the file");
         continue;
       }
     } catch (...) {
       std::cerr << "Failed to read: \"" << filename << "\" in thread " << params->thread << std::endl;
+      if (auditOnly)
+        audit.WriteError(filename, "could not read the file");
       continue;
     }
 
@@ -122,354 +2949,487 @@ void *ReadFilesThread(void *voidparams) {
     // gdcm::AddTag(gdcm::Tag(0x65010010), gdcm::VR::LO, "MY NEW DATASET",
     // reader.GetFile().GetDataSet());
 
-    // maxval = 0xff;
-    // if (DEPTH == 16)
-    //  maxval = 0xffff;
-    int HEIGHT = atoi(sf.ToString(gdcm::Tag(0x0028, 0x0010)).c_str()); // acquisition matrix
-    int WIDTH = atoi(sf.ToString(gdcm::Tag(0x0028, 0x0011)).c_str());  // acquisition matrix
-    // gdcm::Image *im = new gdcm::Image();
-    gdcm::Pixmap &im = reader.GetPixmap(); // is this color or grayscale????
-    if (im.AreOverlaysInPixelData()) {     // we can also have curves in here ... what about curves?
-      for (int i = 0; i < im.GetNumberOfOverlays(); i++) {
-        fprintf(stdout, "Warning: we have found an overlay, we will remove it here.\n");
-        im.RemoveOverlay(i); // TODO: overlays can hide some text - they are not a good way to anonymize a file
-      }
-    }
-    gdcm::Image gimage = reader.GetImage();
-
-    // debug what is in this image??
-
-    PIX *pixs = pixCreate(WIDTH, HEIGHT, 32); // rgba colors
-    size_t length = gimage.GetBufferLength();
-    fprintf(stdout, "%ld buffer length size of a single image is: %dx%d\n", length, HEIGHT, WIDTH);
-    std::vector<char> vbuffer;
-    vbuffer.resize(gimage.GetBufferLength());
-    char *buffer = &vbuffer[0];
-    if (!gimage.GetBuffer(buffer)) {
-      fprintf(stderr, "Could not get buffer for image data\n");
-    }
-    // we have a problem with one file:
-    bool anyNonZero = false;
-    for (int i = 0; i < length; i++) {
-      if (buffer[i] < buffer[0] || buffer[i] > buffer[0]) {
-        anyNonZero = true;
-        break;
-      }
-    }
-    if (anyNonZero) {
-      fprintf(stdout, "FOUND IMAGE INFORMATION (non-zero char)\n");
-    } else {
-      fprintf(stdout, "NO IMAGE INFORMATION FOUND!\n");
-    }
-
-    if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::RGB) {
-      if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) { // hopefully always true
-        fprintf(stdout, "We found RGB data with 8bit! HERE\n");
-        /* // we can check if the length is ok
-        if (length > WIDTH * HEIGHT * 3) {
-          length = WIDTH * HEIGHT * 3; // limit the length to what we can read (important for the icon generation for example - prevents floating point error)
-          fprintf(stdout, "SET LENGTH TO %d\n", length);
-        }*/
-        unsigned char *ubuffer = (unsigned char *)buffer;
-        for (int i = 0; i < HEIGHT; i++) {
-          for (int j = 0; j < WIDTH; j++) {
-            l_uint32 val;
-            l_int32 red = 0;
-            l_int32 green = 0;
-            l_int32 blue = 0;
-            // if im is grayscale or color
-            red = ubuffer[(i * WIDTH + j) * 3 + 0];
-            green = ubuffer[(i * WIDTH + j) * 3 + 1];
-            blue = ubuffer[(i * WIDTH + j) * 3 + 2];
-            composeRGBPixel(red, green, blue, &val);
-            pixSetPixel(pixs, j, i, val);
-          }
-        }
-      } else {
-        // color data with not 8bit per channel!
-        fprintf(stderr, "Error: found color data with non-8bit per channel! Unsupported!\n");
-      }
-    } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::MONOCHROME2) {
-      // we can have 8bit or 16bit grayscales here
-      if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) {
-        fprintf(stdout, "We found MONOCHROME2 data with 8bit!\n");
-        unsigned char *ubuffer = (unsigned char *)buffer;
-        for (int i = 0; i < HEIGHT; i++) {
-          for (int j = 0; j < WIDTH; j++) {
-            l_uint32 val;
-            l_int32 red = 0;
-            l_int32 green = 0;
-            l_int32 blue = 0;
-            // if im is grayscale or color
-            red = ubuffer[i * WIDTH + j];
-            green = ubuffer[i * WIDTH + j];
-            blue = ubuffer[i * WIDTH + j];
-            composeRGBPixel(red, green, blue, &val);
-            pixSetPixel(pixs, j, i, val);
-          }
-        }
-      } else if (gimage.GetPixelFormat() == gdcm::PixelFormat::INT16) { // have not seen an example yet
-        short *buffer16 = (short *)buffer;
-        fprintf(stdout, "We found MONOCHROME2 data with 16bit!\n");
-        for (int i = 0; i < HEIGHT; i++) {
-          for (int j = 0; j < WIDTH; j++) {
-            l_uint32 val;
-            l_int32 red = 0;
-            l_int32 green = 0;
-            l_int32 blue = 0;
-            // if im is grayscale or color, PixelRepresentation is 1, so we have signed values ->
-            // 2complement
-            red = (unsigned char)std::min(255, (32768 + buffer16[i * WIDTH + j]) / 255);
-            green = (unsigned char)std::min(255, (32768 + buffer16[i * WIDTH + j]) / 255);
-            blue = (unsigned char)std::min(255, (32768 + buffer16[i * WIDTH + j]) / 255);
-            composeRGBPixel(red, green, blue, &val);
-            pixSetPixel(pixs, j, i, val);
-          }
-        }
-      } else if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT16) { // we have one example that does not work - every
-                                                                         // pixel is 0
-        // pixel representation is 0 -> unsigned short
-        unsigned short *buffer16 = (unsigned short *)buffer;
-        // anything non-zero?
-        for (int i = 0; i < WIDTH * HEIGHT * 2; i++) {
-          if (buffer[i] != 0)
-            fprintf(stdout, "\"%d\" ", (int)(buffer[i]));
-        }
-        fprintf(stdout, "We found MONOCHROME2 data with 16bit (unsigned short %dx%d)!\n", HEIGHT, WIDTH);
-        for (int i = 0; i < HEIGHT; i++) {
-          for (int j = 0; j < WIDTH; j++) {
-            l_uint32 val;
-            l_int32 red = 0;
-            l_int32 green = 0;
-            l_int32 blue = 0;
-            // if im is grayscale or color
-            // fprintf(stdout, "%d %d ", ((unsigned char *)(&buffer16[i * WIDTH + j]))[0],
-            // ((unsigned char *)(&buffer16[i * WIDTH + j]))[1]);
-            int v = floor((((double)buffer16[i * WIDTH + j] - gimage.GetPixelFormat().GetMin()) / (float)gimage.GetPixelFormat().GetMax()) * 255);
-            red = v; // (unsigned char)std::min(255, (buffer16[i * WIDTH + j]) / 255);
-            // if (v != 0)
-            //  fprintf(stdout, "%d (%lld %lld)\n", v, gimage.GetPixelFormat().GetMin(),
-            //  gimage.GetPixelFormat().GetMax());
-            green = v; // (unsigned char)std::min(255, (buffer16[i * WIDTH + j]) / 255);
-            blue = v;  // (unsigned char)std::min(255, (buffer16[i * WIDTH + j]) / 255);
-            composeRGBPixel(red, green, blue, &val);
-            pixSetPixel(pixs, j, i, val);
-          }
-        }
-      } else {
-        fprintf(stderr, "unknown pixel format in input... nothing is done\n");
-      }
-    } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::YBR_FULL_422) {
-      if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) {
-        fprintf(stdout, "Found PhotometricInterpretation YBR_FULL_422 (UINT8)\n");
-        unsigned char *ubuffer = (unsigned char *)buffer;
-        for (int i = 0; i < HEIGHT; i++) {
-          for (int j = 0; j < WIDTH; j++) {
-            l_uint32 val;
-            l_int32 red = 0;
-            l_int32 green = 0;
-            l_int32 blue = 0;
-            // if im is grayscale or color
-            unsigned char a = ubuffer[(i * WIDTH + j) * 3 + 0];
-            unsigned char b = ubuffer[(i * WIDTH + j) * 3 + 1];
-            unsigned char c = ubuffer[(i * WIDTH + j) * 3 + 2];
-
-            int R = 38142 * (a - 16) + 52298 * (c - 128);
-            int G = 38142 * (a - 16) - 26640 * (c - 128) - 12845 * (b - 128);
-            int B = 38142 * (a - 16) + 66093 * (b - 128);
-
-            R = (R + 16384) >> 15;
-            G = (G + 16384) >> 15;
-            B = (B + 16384) >> 15;
-
-            if (R < 0)
-              R = 0;
-            if (G < 0)
-              G = 0;
-            if (B < 0)
-              B = 0;
-            if (R > 255)
-              R = 255;
-            if (G > 255)
-              G = 255;
-            if (B > 255)
-              B = 255;
-            red = R;
-            green = G;
-            blue = B;
-
-            composeRGBPixel(red, green, blue, &val);
-            pixSetPixel(pixs, j, i, val);
-          }
-        }
+    // maxval = 0xff;
+    // if (DEPTH == 16)
+    //  maxval = 0xffff;
+    int HEIGHT = atoi(sf.ToString(gdcm::Tag(0x0028, 0x0010)).c_str()); // acquisition matrix
+    int WIDTH = atoi(sf.ToString(gdcm::Tag(0x0028, 0x0011)).c_str());  // acquisition matrix
+    // gdcm::Image *im = new gdcm::Image();
+    gdcm::Pixmap &im = reader.GetPixmap(); // is this color or grayscale????
+    if (im.AreOverlaysInPixelData()) {     // we can also have curves in here ... what about curves?
+      for (int i = 0; i < im.GetNumberOfOverlays(); i++) {
+        fprintf(stdout, "Warning: we have found an overlay, we will remove it here.\n");
+        im.RemoveOverlay(i); // TODO: overlays can hide some text - they are not a good way to anonymize a file
       }
-    } else {
-      fprintf(stderr, "Error: cannot process this PhotometricInterpretation.\n");
+    }
+    gdcm::Image gimage = reader.GetImage();
+
+    // debug what is in this image??
+
+    unsigned int nframes = 1;
+    if (gimage.GetNumberOfDimensions() > 2)
+      nframes = std::max(1u, gimage.GetDimension(2));
+    size_t length = gimage.GetBufferLength();
+    const size_t framelength = length / nframes;
+    fprintf(stdout, "%ld buffer length size of a single image is: %dx%d (%d frames)\n", length, HEIGHT, WIDTH, nframes);
+    if (framelength * nframes != length || (size_t)WIDTH * HEIGHT * gimage.GetPixelFormat().GetPixelSize() > framelength) {
+      fprintf(stderr, "Error: pixel data length %ld does not match %d frames of %dx%d\n", length, nframes, WIDTH, HEIGHT);
+      if (auditOnly)
+        audit.WriteError(filename, "pixel data length does not match the image size");
       continue;
     }
 
+    // the decoded frames are written directly into the output pixel data, no other copy of the full image is kept
+    gdcm::DataElement pixeldata(gdcm::Tag(0x7fe0, 0x0010));
+    gdcm::ByteValue *bv = new gdcm::ByteValue();
+    bv->SetLength((uint32_t)length); // length here could be strange, something too big for example
+    char *outbuffer = (char *)bv->GetPointer();
+
     // it might be good to convert all input images to a common format - regardless of the original
     // type, this would allow us to have the conversion below only done once.. but we would always
     // write the same image type back - not very nice...
     // http://gdcm.sourceforge.net/html/ConvertToQImage_8cxx-example.html
-    std::vector<std::string> safeList = {"Patient", "Name", "Study", "Protocol", "Date", "A", "P", "I", "L", "R", "H"};
+    fileinfo info;
+    info.filename = filename;
+    info.sopinstanceuid = filenamestring;
+    info.seriesinstanceuid = seriesdirname;
+    info.studyinstanceuid = studyinstanceuid;
+    info.seriesdescription = seriesdescription;
+    info.studydescription = studydescription;
+    info.modality = sf.ToString(gdcm::Tag(0x0008, 0x0060));
+
+    // options that depend on the modality of this file
+    processingoptions fileopts = params->opts;
+    fileopts.binarize = ModalityOption(params->opts.binarizeByModality, info.modality);
+    std::string profile = ModalityOption(params->opts.ocrProfileByModality, info.modality);
+    if (profile == "")
+      profile = "default";
+    if (!replay && (api == NULL || engines.ProfileOf(api) != profile)) {
+      fprintf(stdout, "use OCR profile \"%s\" for modality %s\n", profile.c_str(), info.modality.c_str());
+      if (api != NULL)
+        engines.Release(api);
+      api = engines.Acquire(profile);
+    }
+    if (!replay && api == NULL) {
+      fprintf(stderr, "Error: no OCR engine for profile \"%s\", %s is not written\n", profile.c_str(), filename);
+      if (auditOnly)
+        audit.WriteError(filename, "no OCR engine for profile " + profile);
+      continue;
+    }
 
-    tesseract::TessBaseAPI *api = new tesseract::TessBaseAPI();
-    api->Init(NULL, "eng+nor"); // this requires a nor.traineddata to be in the
-                                // /usr/local/Cellar/tesseract/4.1.1/share/tessdata directory
-    api->SetImage(pixs);
-    api->SetSourceResolution(70); // tried several, does not seem to make a different (prevents warning)
+    // in temporal mode we only collect statistics while decoding, OCR runs once after all frames are known
+    bool temporal = params->opts.temporal && nframes >= params->opts.temporalMinFrames && !replay;
+    temporalstatistics stats;
+    if (temporal)
+      stats.Init((size_t)WIDTH * HEIGHT);
+    std::vector<unsigned char> gray;
 
-    api->Recognize(0);
+    // multi-frame images where the text can change: hash the text bands to find frames that need OCR again
+    bool useBandHash = params->opts.bandHash > 0 && nframes > 1 && !replay;
+    const int pixelsize = gimage.GetPixelFormat().GetPixelSize();
+    bool haveReference = false;
+    uint64_t referenceHash = 0;
+    unsigned int referenceFrame = 0;
+    std::vector<wordbox> referenceWords;
+    int reusedFrames = 0;
+
+    // ultrasound: the text is around the scan regions, OCR only the rest of the image
+    std::vector<region> ocrarea;
+    bool useOcrArea = false;
+    if (params->opts.usRegionsInside >= 0) {
+      std::vector<region> scanregions = UltrasoundRegions(ds, WIDTH, HEIGHT);
+      if (scanregions.size() > 0) {
+        ocrarea = ComplementRegions(scanregions, WIDTH, HEIGHT, params->opts.usRegionsInside);
+        useOcrArea = true;
+        fprintf(stdout, "%ld ultrasound regions, OCR on %.0f%% of the image\n", scanregions.size(),
+                100.0 * RegionsArea(ocrarea) / ((double)WIDTH * HEIGHT));
+      } else {
+        fprintf(stdout, "no SequenceOfUltrasoundRegions found, OCR on the full image\n");
+      }
+    }
+
+    // later instances of a series: OCR only where text was found before and in the border bands, with a
+    // full OCR every seriesRecheck instances
+    seriesstate &series = params->series[info.seriesinstanceuid];
+    if (series.width != WIDTH || series.height != HEIGHT) {
+      series = seriesstate();
+      series.width = WIDTH;
+      series.height = HEIGHT;
+    }
+    if (params->opts.seriesLearn > 0 && series.instances >= params->opts.seriesLearn) {
+      bool recheck = params->opts.seriesRecheck > 0 && (series.instances - params->opts.seriesLearn + 1) % params->opts.seriesRecheck == 0;
+      if (recheck) {
+        fprintf(stdout, "series: instance %d gets a full OCR re-check\n", series.instances);
+      } else {
+        std::vector<region> known = BorderBands(WIDTH, HEIGHT, params->opts.seriesBand);
+        known.insert(known.end(), series.textregions.begin(), series.textregions.end());
+        MergeRegions(known);
+        ocrarea = useOcrArea ? IntersectRegions(ocrarea, known) : known;
+        useOcrArea = true;
+        fprintf(stdout, "series: %ld known text regions, OCR on %.0f%% of the image\n", series.textregions.size(),
+                100.0 * RegionsArea(ocrarea) / ((double)WIDTH * HEIGHT));
+      }
+    }
+    std::vector<wordbox> keptWords; // words of this instance that pass the filter policy, for the series state and templates
+    std::set<std::string> phi;
+    if (params->opts.propagate)
+      phi = PHIStrings(sf);
 
-    // for debugging write out the pix
-    if (1) {
-      pixWrite("/tmp/tess_input.png", pixs, IFF_PNG);
-      Pix *page_pix = api->GetThresholdedImage();
-      pixWrite("/tmp/tess_thresholded.png", page_pix, IFF_PNG);
+    // known devices: the template regions are masked without OCR, only the border bands outside of them are
+    // OCR'd to discover new text (new text in the center of the image is never found)
+    std::string devicekey = DeviceKey(sf);
+    devicetemplate device;
+    if (params->opts.templates != "")
+      device = templates.Get(devicekey);
+    std::vector<std::unique_ptr<textdetector>> cascade = CreateCascade(fileopts, info.modality);
+    std::string cascadenames = "";
+    for (int i = 0; i < cascade.size(); i++)
+      cascadenames += (i > 0 ? "+" : "") + cascade[i]->Name();
+    fprintf(stdout, "detectors: %s\n", cascadenames.c_str());
+    std::vector<region> templateRegions = device.Confirmed(params->opts.templateMinInstances);
+    bool useTemplate = !replay && params->opts.templateFast && device.instances >= params->opts.templateMinInstances && templateRegions.size() > 0;
+    if (useTemplate) {
+      std::vector<region> discover =
+          IntersectRegions(BorderBands(WIDTH, HEIGHT, params->opts.templateBand), ComplementRegions(templateRegions, WIDTH, HEIGHT, 0.0f));
+      ocrarea = useOcrArea ? IntersectRegions(ocrarea, discover) : discover;
+      useOcrArea = true;
+      fprintf(stdout, "template: device \"%s\" (%d instances) has %ld text regions, OCR on %.0f%% of the image\n", devicekey.c_str(),
+              device.instances, templateRegions.size(), 100.0 * RegionsArea(ocrarea) / ((double)WIDTH * HEIGHT));
     }
 
-    tesseract::ResultIterator *ri = api->GetIterator();
-    tesseract::PageIteratorLevel level = tesseract::RIL_WORD;
+    const bool color = gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::RGB ||
+                       gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::YBR_FULL_422;
+
+    // cached OCR results depend on the pixel data and on everything that changes the detection
+    const bool useCache = params->opts.cache != "";
+    std::string settings = ProfileSettings(profile) + "|" + cascadenames + "|" + DetectionSettings(fileopts) + "|" + std::to_string(WIDTH) +
+                           "x" + std::to_string(HEIGHT) + "|" + std::to_string(color);
+    if (cascadenames.find("glyphs") != std::string::npos)
+      settings += "|" + GlyphSettings(FindGlyphFont(devicekey));
+    for (int i = 0; useOcrArea && i < ocrarea.size(); i++)
+      settings += "|" + std::to_string(ocrarea[i].x1) + "," + std::to_string(ocrarea[i].y1) + "," + std::to_string(ocrarea[i].x2) + "," +
+                  std::to_string(ocrarea[i].y2);
+    const uint64_t settingsHash = HashBytes(settings.data(), settings.size());
+
+    int framewindow = std::max(1, params->opts.framewindow);
     int counter = 0;
-    if (ri != 0) {
-      do {
-        if (ri->Empty(level)) {
-          fprintf(stdout, "ignore this level, its empty\n");
-          continue;
+    bool readError = false;
+    for (unsigned int z0 = 0; z0 < nframes && !readError; z0 += framewindow) {
+      unsigned int z1 = std::min(nframes, z0 + framewindow) - 1;
+      gdcm::BoxRegion box;
+      box.SetDomain(0, WIDTH - 1, 0, HEIGHT - 1, z0, z1);
+      reader.SetRegion(box);
+      size_t windowlength = reader.ComputeBufferLength();
+      if (windowlength != (z1 - z0 + 1) * framelength) {
+        fprintf(stderr, "Error: unexpected buffer length %ld for frames %d..%d\n", windowlength, z0, z1);
+        readError = true;
+        break;
+      }
+      try {
+        if (!reader.ReadIntoBuffer(outbuffer + z0 * framelength, windowlength)) {
+          fprintf(stderr, "Could not get buffer for image data (frames %d..%d)\n", z0, z1);
+          readError = true;
+          break;
         }
-        const char *word = ri->GetUTF8Text(level);
-        const char *word_recognition_language = ri->WordRecognitionLanguage();
-        float conf = ri->Confidence(level); // we don't care
-        int x1, y1, x2, y2;
-        ri->BoundingBox(level, &x1, &y1, &x2, &y2);
-        // add some margin and make the selection bigger
-        int margin = 2;
-        x1 -= margin;
-        x2 += margin;
-        y1 -= margin;
-        y2 += margin;
-        if (x1 < 0)
-          x1 = 0;
-        if (x2 > WIDTH)
-          x2 = WIDTH;
-        if (y1 < 0)
-          y1 = 0;
-        if (y2 > HEIGHT)
-          y2 = HEIGHT;
-
-        if (params->saveMappings) {
-          // if we store the results we can write them into the thread storage
-          char numObjects[11];
-          snprintf(numObjects, 11, "%04d", counter++);
-          std::string key = filenamestring + "_" + numObjects;
-          nlohmann::json info = nlohmann::json::object();
-          info["word"] = word ? std::string(word) : std::string("");
-          info["confidence"] = conf;
-          info["word_recognition_language"] = word_recognition_language ? std::string(word_recognition_language) : std::string("");
-          info["word_is_from_dictionary"] = ri->WordIsFromDictionary();
-          info["word_is_number"] = ri->WordIsNumeric();
-          info["bounding_box"] = nlohmann::json::object({{"x1", x1}, {"y1", y1}, {"x2", x2}, {"y2", y2}});
-          info["SOPInstanceUID"] = filenamestring;
-          info["SeriesInstanceUID"] = seriesdirname;
-          info["StudyInstanceUID"] = studyinstanceuid;
-          info["SeriesDescription"] = seriesdescription;
-          info["StudyDescription"] = studydescription;
-          info["filename"] = filename;
-          std::string value = info.dump();
-
-          params->byThreadStudyInstanceUID.insert(std::pair<std::string, std::string>(key, value)); // should only add this pair once
-        }
-        // we can check against a safe list here
-        if (std::find(safeList.begin(), safeList.end(), word) != safeList.end()) {
-          printf("skip-word: '%s'; \tconf: %.2f; BoundingBox: %d,%d,%d,%d;\n", word, conf, x1, y1, x2, y2);
-          continue; // found a safeList entry, don't do anything
-        }
-        // check if the word is a number? But we don't want to see dates either...
-        // check for confidence
-        if (conf < params->confidence) {
-          printf("skip-word - low confidence: '%s'; \tconf: %.2f; BoundingBox: %d,%d,%d,%d;\n", word, conf, x1, y1, x2, y2);
-          continue;
+      } catch (...) {
+        fprintf(stderr, "Could not get buffer for image data (frames %d..%d)\n", z0, z1);
+        readError = true;
+        break;
+      }
+
+      for (unsigned int z = z0; z <= z1; z++) {
+        char *buffer = outbuffer + z * framelength;
+        if (z == 0) {
+          // we have a problem with one file:
+          bool anyNonZero = false;
+          for (size_t i = 0; i < framelength; i++) {
+            if (buffer[i] < buffer[0] || buffer[i] > buffer[0]) {
+              anyNonZero = true;
+              break;
+            }
+          }
+          if (anyNonZero) {
+            fprintf(stdout, "FOUND IMAGE INFORMATION (non-zero char)\n");
+          } else {
+            fprintf(stdout, "NO IMAGE INFORMATION FOUND!\n");
+          }
         }
 
-        if (strlen(word) == 1) {
-          printf("skip-word - single character: '%s'; \tconf: %.2f; BoundingBox: %d,%d,%d,%d;\n", word, conf, x1, y1, x2, y2);
+        if (replay)
+          continue; // the boxes are masked after all frames are decoded
+
+        if (temporal) {
+          if (!FrameToGray(buffer, WIDTH, HEIGHT, gimage, gray)) {
+            readError = true;
+            break;
+          }
+          stats.Add(&gray[0]);
           continue;
         }
 
-        printf("word: '%s';  \tconf: %.2f; BoundingBox: %d,%d,%d,%d;\n", word, conf, x1, y1, x2, y2);
-        // mask out the bounding box with black
-        if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::RGB) {
-          if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) { // hopefully always true
-                                                                     // change values in the buffer
-            unsigned char *ubuffer = (unsigned char *)buffer;
-            for (int i = y1; i < y2; i++) {
-              for (int j = x1; j < x2; j++) {
-                ubuffer[(i * WIDTH + j) * 3 + 0] = 0;
-                ubuffer[(i * WIDTH + j) * 3 + 1] = 0;
-                ubuffer[(i * WIDTH + j) * 3 + 2] = 0;
-              }
-            }
+        // if the text bands and the known text regions did not change we can keep the words of the reference frame
+        std::vector<wordbox> words;
+        bool reuse = false;
+        if (useBandHash && haveReference) {
+          reuse = HashBands(buffer, WIDTH, HEIGHT, pixelsize, params->opts.bandHash, referenceWords) == referenceHash;
+          if (reuse) {
+            fprintf(stdout, "frame %d: text bands unchanged, re-use OCR result of frame %d\n", z, referenceFrame);
+            words = referenceWords;
+            reusedFrames++;
           }
-        } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::MONOCHROME2) {
-          // we can have 8bit or 16bit grayscales here
-          if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) {
-            unsigned char *ubuffer = (unsigned char *)buffer;
-            // fprintf(stdout, "We found MONOCHROME2 data with uint8 8bit!\n");
-            for (int i = y1; i < y2; i++) {
-              for (int j = x1; j < x2; j++) {
-                ubuffer[i * WIDTH + j] = 0;
-              }
+        }
+        if (!reuse) {
+          // small images were recognized in a mosaic already, otherwise the detector cascade runs
+          mosaicwords::const_iterator pre = batched.find(filename);
+          const bool inMosaic = pre != batched.end() && z < pre->second.size();
+          const uint64_t cachekey = useCache && !inMosaic ? HashBytes(buffer, framelength, settingsHash) : 0;
+          PIX *framepix = NULL; // the frame as converted by the detectors, if they did
+          if (inMosaic) {
+            words = pre->second[z];
+          } else if (useCache && ocrresults.Get(cachekey, words)) {
+            fprintf(stdout, "cache: frame %d has %ld cached words\n", z, words.size());
+          } else {
+            detectorinput in;
+            in.buffer = buffer;
+            in.frame = z;
+            in.width = WIDTH;
+            in.height = HEIGHT;
+            in.gimage = &gimage;
+            in.info = &info;
+            in.opts = &fileopts;
+            in.devicekey = devicekey;
+            in.color = color;
+            in.api = api;
+            if (useOcrArea) {
+              in.regions = ocrarea;
+              in.restricted = true;
             }
-          } else if (gimage.GetPixelFormat() == gdcm::PixelFormat::INT16) { // have not seen an example yet
-            short *buffer16 = (short *)buffer;
-            // fprintf(stdout, "We found MONOCHROME2 data with 16bit int16!\n");
-            for (int i = y1; i < y2; i++) {
-              for (int j = x1; j < x2; j++) {
-                buffer16[i * WIDTH + j] = 0;
-              }
+            auto ocrstart = std::chrono::steady_clock::now();
+            int stopped = RunCascade(cascade, in, words);
+            if (in.failed) {
+              readError = true;
+              break;
             }
-          } else if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT16) { // have not seen an example yet
-            unsigned short *buffer16 = (unsigned short *)buffer;
-            // fprintf(stdout, "We found MONOCHROME2 data with 16bit (unsigned short)!\n");
-            for (int i = y1; i < y2; i++) {
-              for (int j = x1; j < x2; j++) {
-                buffer16[i * WIDTH + j] = 0;
-              }
+            if (stopped >= 0 && cascade[stopped]->Name() == "gate") {
+              params->gateSkipped++;
+            } else if (in.usedEngine) { // frames ended by proposals or glyphs did not run OCR
+              params->ocrSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - ocrstart).count();
+              params->ocrFrames++;
+            }
+
+            // for debugging write out the pix (not in audit mode, nothing is written there)
+            if (z == 0 && in.usedEngine && !auditOnly) {
+              pixWrite("/tmp/tess_input.png", in.pixs, IFF_PNG);
+              Pix *page_pix = api->GetThresholdedImage();
+              pixWrite("/tmp/tess_thresholded.png", page_pix, IFF_PNG);
+              pixDestroy(&page_pix);
             }
+            if (useCache)
+              ocrresults.Put(cachekey, words);
+            if (params->opts.propagate && in.pixs != NULL)
+              framepix = pixClone(in.pixs);
           }
-        } else if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::YBR_FULL_422) {
-          if (gimage.GetPixelFormat() == gdcm::PixelFormat::UINT8) { // hopefully always true
-                                                                     // change values in the buffer
-            unsigned char *ubuffer = (unsigned char *)buffer;        // but buffer has the wrong encoding now
-            for (int i = y1; i < y2; i++) {
-              for (int j = x1; j < x2; j++) { // hope this is ok for YBR data as well
-                ubuffer[(i * WIDTH + j) * 3 + 0] = 0;
-                ubuffer[(i * WIDTH + j) * 3 + 1] = 0;
-                ubuffer[(i * WIDTH + j) * 3 + 2] = 0;
+
+          // bitmaps of PHI words found in other instances of this study are searched in this frame, PHI words
+          // found here are kept as bitmaps for the next frames and instances. Nothing to do without bitmaps and PHI strings,
+          // the frame is converted only if the detectors did not do this already.
+          std::vector<glyph> bitmaps;
+          if (params->opts.propagate)
+            bitmaps = phibitmaps.Get(info.studyinstanceuid);
+          if (params->opts.propagate && !(bitmaps.empty() && phi.empty())) {
+            PIX *pixs = framepix != NULL ? framepix : FrameToPix(buffer, WIDTH, HEIGHT, gimage);
+            framepix = NULL;
+            PIX *binary = pixs != NULL ? BinarizeForOCR(pixs, "otsu") : NULL;
+            pixDestroy(&pixs);
+            if (binary != NULL) {
+              std::vector<float> img = BinaryToFloat(binary);
+              pixDestroy(&binary);
+              std::vector<wordbox> found = FindBitmaps(img, WIDTH, HEIGHT, bitmaps);
+              const size_t detected = words.size();
+              for (int f = 0; f < found.size(); f++) {
+                const int cx = (found[f].x1 + found[f].x2) / 2;
+                const int cy = (found[f].y1 + found[f].y2) / 2;
+                bool known = false;
+                for (int w = 0; w < detected && !known; w++)
+                  known = cx >= words[w].x1 && cx < words[w].x2 && cy >= words[w].y1 && cy < words[w].y2;
+                if (!known)
+                  words.push_back(found[f]);
+              }
+              std::vector<glyph> candidates;
+              for (int w = 0; w < detected; w++) {
+                if (phi.count(NormalizeWord(words[w].word)) == 0)
+                  continue;
+                glyph g;
+                if (!CropGlyph(img, WIDTH, words[w].x1, words[w].y1, words[w].x2 - words[w].x1, words[w].y2 - words[w].y1, g))
+                  continue;
+                g.label = words[w].word;
+                candidates.push_back(g);
               }
+              const int learned = candidates.empty() ? 0 : phibitmaps.Add(info.studyinstanceuid, candidates);
+              if (words.size() > detected || learned > 0)
+                fprintf(stdout, "propagate: frame %d, %ld PHI bitmaps found, %d new PHI bitmaps\n", z, words.size() - detected, learned);
             }
-          } else {
-            fprintf(stderr, "ERROR: could not interpret non-UINT8 YBR_FULL_422 data\n");
           }
-        } else {
-          fprintf(stdout, "Error: unknown data\n");
+
+          pixDestroy(&framepix);
+
+          if (useBandHash) { // hash before masking, masking changes the pixel values
+            referenceWords = words;
+            referenceHash = HashBands(buffer, WIDTH, HEIGHT, pixelsize, params->opts.bandHash, referenceWords);
+            referenceFrame = z;
+            haveReference = true;
+          }
         }
-        delete[] word;
 
-        // now mask the pixel values
-      } while (ri->Next(level));
+        for (int w = 0; w < words.size(); w++) {
+          const bool keep = KeepWord(params, words[w]);
+          if (params->saveMappings)
+            StoreWord(params, info, words[w], z, keep, counter);
+          params->wordsFound++;
+          if (!keep)
+            continue;
+          params->wordsMasked++;
+          keptWords.push_back(words[w]);
+          // now mask the pixel values
+          if (!auditOnly)
+            MaskRegion(buffer, WIDTH, HEIGHT, gimage, words[w].x1, words[w].y1, words[w].x2, words[w].y2);
+        }
+      }
+    }
+    if (useBandHash)
+      fprintf(stdout, "band hash: re-used OCR results for %d of %d frames\n", reusedFrames, nframes);
+    if (temporal && !readError) {
+      // burned in text does not move, OCR only the static high-contrast regions of one representative frame
+      PIX *staticmask = stats.StaticMask(WIDTH, HEIGHT, params->opts.staticTolerance, params->opts.staticContrast);
+      std::vector<region> regions = MaskToRegions(staticmask, WIDTH, HEIGHT);
+      pixDestroy(&staticmask);
+      unsigned int representative = nframes / 2;
+      fprintf(stdout, "temporal mode: %ld static regions in %d frames, OCR on frame %d\n", regions.size(), nframes, representative);
+
+      std::vector<wordbox> words;
+      if (regions.size() > 0) {
+        PIX *pixs = FrameToPix(outbuffer + representative * framelength, WIDTH, HEIGHT, gimage);
+        if (pixs != NULL) {
+          auto ocrstart = std::chrono::steady_clock::now();
+          words = RecognizeWords(api, pixs, WIDTH, HEIGHT, &regions);
+          params->ocrSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - ocrstart).count();
+          params->ocrFrames++;
+          pixDestroy(&pixs);
+        }
+      }
+      for (int w = 0; w < words.size(); w++) {
+        const bool keep = KeepWord(params, words[w]);
+        if (params->saveMappings)
+          StoreWord(params, info, words[w], -1, keep, counter);
+        params->wordsFound++;
+        if (!keep)
+          continue;
+        params->wordsMasked++;
+        keptWords.push_back(words[w]);
+        // the same static text is in every frame
+        for (unsigned int z = 0; z < nframes && !auditOnly; z++)
+          MaskRegion(outbuffer + z * framelength, WIDTH, HEIGHT, gimage, words[w].x1, words[w].y1, words[w].x2, words[w].y2);
+      }
+    }
+    if (readError) {
+      if (auditOnly)
+        audit.WriteError(filename, "could not decode the pixel data");
+      delete bv;
+      continue;
+    }
+    if (replay) {
+      // exactly the boxes of the mapping are masked, there is no filter policy for reviewed boxes
+      std::map<std::string, std::vector<std::pair<int, wordbox>>>::const_iterator it = replaymapping.instances.find(info.sopinstanceuid);
+      if (it == replaymapping.instances.end()) {
+        fprintf(stdout, "replay: no boxes for %s in the mapping\n", info.sopinstanceuid.c_str());
+      } else {
+        for (int i = 0; i < it->second.size(); i++) {
+          const int frame = it->second[i].first;
+          wordbox w = it->second[i].second;
+          if (frame >= (int)nframes) {
+            fprintf(stderr, "Warning: replay box for frame %d, %s has %d frames\n", frame, filename, nframes);
+            continue;
+          }
+          region r = {w.x1, w.y1, w.x2, w.y2};
+          if (!ClipRegion(r, WIDTH, HEIGHT)) {
+            fprintf(stderr, "Warning: replay box %d,%d,%d,%d is outside of the %dx%d image %s\n", w.x1, w.y1, w.x2, w.y2, WIDTH, HEIGHT,
+                    filename);
+            continue;
+          }
+          w.x1 = r.x1; // the mapping gets the box that was masked
+          w.y1 = r.y1;
+          w.x2 = r.x2;
+          w.y2 = r.y2;
+          if (params->saveMappings)
+            StoreWord(params, info, w, frame, true, counter);
+          params->wordsFound++;
+          params->wordsMasked++;
+          printf("replay: '%s'; frame %d; BoundingBox: %d,%d,%d,%d;\n", w.word.c_str(), frame, w.x1, w.y1, w.x2, w.y2);
+          for (unsigned int z = (frame < 0 ? 0 : frame); z < (frame < 0 ? nframes : frame + 1) && !auditOnly; z++)
+            MaskRegion(outbuffer + z * framelength, WIDTH, HEIGHT, gimage, r.x1, r.y1, r.x2, r.y2);
+        }
+      }
+    }
+    std::vector<region> templateMasked; // reported by the audit, the template regions are not OCR'd
+    if (useTemplate) {
+      for (int i = 0; i < templateRegions.size(); i++) {
+        region r = templateRegions[i]; // from the template file
+        if (!ClipRegion(r, WIDTH, HEIGHT))
+          continue;
+        templateMasked.push_back(r);
+        wordbox w = {"template", "", 100.0f, false, false, r.x1, r.y1, r.x2, r.y2};
+        if (params->saveMappings)
+          StoreWord(params, info, w, -1, true, counter);
+        params->wordsFound++;
+        params->wordsMasked++;
+        printf("template: BoundingBox: %d,%d,%d,%d;\n", r.x1, r.y1, r.x2, r.y2);
+        for (unsigned int z = 0; z < nframes && !auditOnly; z++)
+          MaskRegion(outbuffer + z * framelength, WIDTH, HEIGHT, gimage, r.x1, r.y1, r.x2, r.y2);
+      }
+    }
+    // safe list words, single characters and low confidence words are not text regions of the series or device
+    const int margin = 8; // text in the next instance can be a bit longer
+    std::vector<region> found = WordRegions(keptWords, WIDTH, HEIGHT, margin);
+    if (params->opts.seriesLearn > 0) {
+      series.textregions.insert(series.textregions.end(), found.begin(), found.end());
+      MergeRegions(series.textregions);
+    }
+    series.instances++;
+    if (params->opts.templates != "" && !replay && !auditOnly)
+      templates.Add(devicekey, found);
+    if (auditOnly) {
+      // detection only: no masking, no icon and nothing is written
+      nlohmann::json finding = nlohmann::json::object();
+      finding["filename"] = info.filename;
+      finding["SOPInstanceUID"] = info.sopinstanceuid;
+      finding["SeriesInstanceUID"] = info.seriesinstanceuid;
+      finding["Modality"] = info.modality;
+      finding["frames"] = nframes;
+      finding["words"] = params->wordsFound - wordsFoundBefore;
+      finding["masked"] = params->wordsMasked - wordsMaskedBefore;
+      nlohmann::json regions = nlohmann::json::array();
+      for (int i = 0; i < found.size(); i++)
+        regions.push_back({found[i].x1, found[i].y1, found[i].x2, found[i].y2});
+      for (int i = 0; i < templateMasked.size(); i++)
+        regions.push_back({templateMasked[i].x1, templateMasked[i].y1, templateMasked[i].x2, templateMasked[i].y2});
+      finding["regions"] = regions;
+      finding["seconds"] = std::chrono::duration<double>(std::chrono::steady_clock::now() - filestart).count();
+      finding["ocr_seconds"] = params->ocrSeconds - ocrSecondsBefore + batchedSeconds[filename];
+      audit.Write(finding);
+      fprintf(stdout, "audit: %s %d of %d words would be masked (%.2f seconds)\n", filename, finding["masked"].get<int>(),
+              finding["words"].get<int>(), finding["seconds"].get<double>());
+      delete bv;
+      continue;
     }
-    api->End();
     // im.SetBuffer(buffer);
     // fileToAnon.SetPixmap();
     // we need to set the pixel data again that we write, in fileToAnon  (good example
     // https://github.com/malaterre/GDCM/blob/master/Applications/Cxx/gdcmimg.cxx)
-    gdcm::DataElement pixeldata(gdcm::Tag(0x7fe0, 0x0010));
-    gdcm::ByteValue *bv = new gdcm::ByteValue();
-    bv->SetLength((uint32_t)length); // length here could be strange, something too big for example
-    memcpy((void *)bv->GetPointer(), (void *)buffer, length);
     pixeldata.SetValue(*bv);
+    if (im.GetTransferSyntax().IsEncapsulated()) {
+      // the frames are decoded now, we cannot keep the compressed transfer syntax
+      im.SetTransferSyntax(gdcm::TransferSyntax::ExplicitVRLittleEndian);
+    }
     if (gimage.GetPhotometricInterpretation() == gdcm::PhotometricInterpretation::YBR_FULL_422) { // for YBR_FULL_422
       // we get an error if the transfer syntax is JPEG baseline 1
       gdcm::TransferSyntax ts = gdcm::TransferSyntax::ExplicitVRBigEndian;
@@ -543,6 +3503,9 @@ void *ReadFilesThread(void *voidparams) {
       std::cout << "Caught exception \"" << ex.what() << "\"\n";
     }
   }
+  params->peakThreads = std::max(params->peakThreads, ThreadCount());
+  if (api != NULL)
+    engines.Release(api);
   return voidparams;
 }
 
@@ -555,9 +3518,38 @@ void ShowFilenames(const threadparams &params) {
   std::cout << "end" << std::endl;
 }
 
-void ReadFiles(size_t nfiles, const char *filenames[], const char *outputdir, int numthreads, float confidence, std::string storeMappingAsJSON) {
+// order the files by study and/or series so that the instances of a series or study are processed by the same
+// thread, only the header up to the series instance uid is read
+void SortByStudyOrSeries(size_t nfiles, const char *filenames[], bool byStudy, bool bySeries) {
+  std::vector<std::pair<std::string, const char *>> byuid(nfiles);
+  for (size_t i = 0; i < nfiles; i++) {
+    gdcm::Reader reader;
+    reader.SetFileName(filenames[i]);
+    std::string uid = "";
+    try {
+      if (reader.ReadUpToTag(gdcm::Tag(0x0020, 0x000E))) {
+        gdcm::StringFilter sf;
+        sf.SetFile(reader.GetFile());
+        if (byStudy)
+          uid = sf.ToString(gdcm::Tag(0x0020, 0x000D));
+        if (bySeries)
+          uid += "|" + sf.ToString(gdcm::Tag(0x0020, 0x000E));
+      }
+    } catch (...) {
+    }
+    byuid[i] = std::make_pair(uid, filenames[i]);
+  }
+  std::stable_sort(byuid.begin(), byuid.end(),
+                   [](const std::pair<std::string, const char *> &a, const std::pair<std::string, const char *> &b) { return a.first < b.first; });
+  for (size_t i = 0; i < nfiles; i++)
+    filenames[i] = byuid[i].second;
+}
+
+runstatistics ReadFiles(size_t nfiles, const char *filenames[], const char *outputdir, int numthreads, const processingoptions &opts,
+                        std::string storeMappingAsJSON) {
   // \precondition: nfiles > 0
   assert(nfiles > 0);
+  auto start = std::chrono::steady_clock::now();
 
   // lets change the DICOM dictionary and add some private tags - this is still not sufficient to be
   // able to write the private tags
@@ -587,6 +3579,41 @@ void ReadFiles(size_t nfiles, const char *filenames[], const char *outputdir, in
     numthreads = 1; // fallback if we don't have enough files to process
   }
 
+  if ((opts.seriesLearn > 0 || opts.propagate) && numthreads > 1)
+    SortByStudyOrSeries(nfiles, filenames, opts.propagate, opts.seriesLearn > 0);
+  phibitmaps.studies.clear(); // PHI bitmaps are not kept between runs
+  if (opts.cache != "") {
+    ocrresults.directory = opts.cache;
+    mkdir(opts.cache.c_str(), 0777);
+  }
+  if (opts.replay != "") {
+    if (!replaymapping.Load(opts.replay)) {
+      fprintf(stderr, "Error: could not read the mapping %s for replay\n", opts.replay.c_str());
+      return runstatistics();
+    }
+    fprintf(stdout, "Info: replay %d boxes of %ld instances from %s without OCR\n", replaymapping.boxes, replaymapping.instances.size(),
+            opts.replay.c_str());
+  }
+  if (opts.audit != "") {
+    audit.file.open(opts.audit, std::ios::app);
+    if (!audit.file.is_open()) {
+      fprintf(stderr, "Error: could not open the audit file %s\n", opts.audit.c_str());
+      return runstatistics();
+    }
+  }
+  if (opts.templates != "" && templates.Load(opts.templates))
+    fprintf(stdout, "Info: %ld device templates read from %s\n", templates.devices.size(), opts.templates.c_str());
+
+  // a thread keeps an engine per profile it needs, files of other modalities do not end and reload its engine
+  std::set<std::string> profilesInUse;
+  for (std::map<std::string, std::string>::const_iterator it = opts.ocrProfileByModality.begin(); it != opts.ocrProfileByModality.end(); ++it)
+    profilesInUse.insert(it->second == "" ? "default" : it->second);
+  if (opts.ocrProfileByModality.find("") == opts.ocrProfileByModality.end())
+    profilesInUse.insert("default");
+  engines.maxBusy = std::max(numthreads, opts.maxEngines);
+  engines.capacity = engines.maxBusy * profilesInUse.size();
+  engines.threadsPerEngine = std::max(1, opts.ompThreads);
+
   const unsigned int nthreads = numthreads; // how many do we want to use?
   threadparams params[nthreads];
 
@@ -600,7 +3627,7 @@ void ReadFiles(size_t nfiles, const char *filenames[], const char *outputdir, in
     params[thread].outputdir = outputdir;
     params[thread].nfiles = partition;
     params[thread].thread = thread;
-    params[thread].confidence = confidence;
+    params[thread].opts = opts;
     params[thread].saveMappings = false;
     if (storeMappingAsJSON.length() > 0) {
       params[thread].saveMappings = true; // store the keys in the params section for later export
@@ -650,7 +3677,125 @@ void ReadFiles(size_t nfiles, const char *filenames[], const char *outputdir, in
     jsonfile.close();
   }
 
+  runstatistics stats;
+  int gateSkipped = 0;
+  int peakThreads = 0;
+  for (unsigned int thread = 0; thread < nthreads; thread++) {
+    peakThreads = std::max(peakThreads, params[thread].peakThreads);
+    stats.ocrSeconds += params[thread].ocrSeconds;
+    stats.ocrFrames += params[thread].ocrFrames;
+    stats.wordsFound += params[thread].wordsFound;
+    stats.wordsMasked += params[thread].wordsMasked;
+    gateSkipped += params[thread].gateSkipped;
+  }
+  fprintf(stdout, "Info: OCR took %.2f seconds for %d frames (%.1f ms per frame)\n", stats.ocrSeconds, stats.ocrFrames,
+          stats.ocrFrames > 0 ? 1000.0 * stats.ocrSeconds / stats.ocrFrames : 0.0);
+  if (opts.gate > 0)
+    fprintf(stdout, "Info: the text gate skipped OCR for %d frames\n", gateSkipped);
+  fprintf(stdout, "Info: at most %d threads in the process for %d file threads x %d OCR threads\n", peakThreads, nthreads,
+          std::max(1, opts.ompThreads));
+  if (opts.cache != "")
+    fprintf(stdout, "Info: OCR cache %d hits, %d misses\n", ocrresults.hits, ocrresults.misses);
+  if (opts.audit != "") {
+    fprintf(stdout, "Info: audit found text to mask in %d of %d files (%d could not be read), findings in %s\n", audit.filesWithText,
+            audit.files, audit.errors, opts.audit.c_str());
+    audit.file.close();
+  }
+
+  if (opts.templates != "" && opts.audit != "") {
+    fprintf(stdout, "Info: audit mode, device templates are not updated\n");
+  } else if (opts.templates != "" && templates.broken) {
+    fprintf(stderr, "Error: device templates not written, %s could not be read\n", opts.templates.c_str());
+  } else if (opts.templates != "") {
+    if (templates.Save(opts.templates))
+      fprintf(stdout, "Info: %ld device templates written to %s\n", templates.devices.size(), opts.templates.c_str());
+    else
+      fprintf(stderr, "Error: could not write device templates to %s\n", opts.templates.c_str());
+  }
+
+  // every engine holds its own copy of the models, engines are created one at a time but the other threads
+  // keep decoding images while an engine is created
+  const int createdEngines = engines.created;
+  fprintf(stdout, "Info: %d OCR engines for %d threads, resident memory %.0f MB (about %.0f MB per engine when it was created)\n",
+          createdEngines, nthreads, ResidentMemoryMB(), createdEngines > 0 ? engines.createdMB / createdEngines : 0.0);
+  engines.Clear();
   delete[] pthread;
+  stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+// process all files with different splits of the cores into file threads and OpenMP threads per OCR engine
+// and report the throughput of each split, the output files are overwritten by each run. The OpenMP thread limit
+// is fixed when a program starts, so each split runs in a new process with the same arguments.
+void RunScalingBenchmark(size_t nfiles, int cores, int argc, char *argv[]) {
+  std::vector<std::pair<int, double>> results;
+  for (int numthreads = 1; numthreads <= cores && numthreads <= nfiles; numthreads *= 2) {
+    const int ompThreads = std::max(1, cores / numthreads);
+    fprintf(stdout, "scaling: %d file threads x %d OCR threads\n", numthreads, ompThreads);
+    std::string threadsArg = std::to_string(numthreads);
+    std::string ompArg = std::to_string(ompThreads);
+    std::vector<char *> args;
+    for (int i = 0; i < argc; i++) {
+      if (strcmp(argv[i], "--scaling") != 0)
+        args.push_back(argv[i]);
+    }
+    args.push_back((char *)"--numthreads");
+    args.push_back((char *)threadsArg.c_str());
+    args.push_back((char *)"--ompthreads");
+    args.push_back((char *)ompArg.c_str());
+    args.push_back(NULL);
+    setenv("OMP_THREAD_LIMIT", ompArg.c_str(), 1); // for the new process, this process does no OCR
+    fflush(stdout);
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+      execv("/proc/self/exe", &args[0]);
+      _exit(127);
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "Error: the run with %d file threads failed\n", numthreads);
+      continue;
+    }
+    results.push_back(std::make_pair(numthreads, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()));
+  }
+  fprintf(stdout, "\nscaling over %ld files on %d cores:\n", nfiles, cores);
+  fprintf(stdout, "%12s %12s %10s %10s\n", "file threads", "OCR threads", "seconds", "files/s");
+  int best = 0;
+  for (int i = 0; i < results.size(); i++) {
+    const double seconds = results[i].second;
+    fprintf(stdout, "%12d %12d %10.2f %10.2f\n", results[i].first, std::max(1, cores / results[i].first), seconds,
+            seconds > 0 ? nfiles / seconds : 0.0);
+    if (seconds < results[best].second)
+      best = i;
+  }
+  if (results.size() > 0)
+    fprintf(stdout, "best: --numthreads %d --ompthreads %d\n", results[best].first, std::max(1, cores / results[best].first));
+}
+
+// process all files once with each OCR profile and report throughput and detections per profile,
+// the output files are overwritten by each run
+void RunBenchmark(size_t nfiles, const char *filenames[], const char *outputdir, int numthreads, const processingoptions &opts) {
+  std::vector<std::pair<std::string, runstatistics>> results;
+  for (std::map<std::string, ocrprofile>::const_iterator it = ocrprofiles.begin(); it != ocrprofiles.end(); ++it) {
+    fprintf(stdout, "benchmark: OCR profile \"%s\"\n", it->first.c_str());
+    processingoptions profileopts = opts;
+    profileopts.ocrProfileByModality.clear();
+    profileopts.ocrProfileByModality[""] = it->first;
+    // state that is kept between runs would make the later profiles look faster
+    profileopts.templates = "";
+    profileopts.cache = "";
+    profileopts.replay = "";
+    profileopts.audit = "";
+    results.push_back(std::make_pair(it->first, ReadFiles(nfiles, filenames, outputdir, numthreads, profileopts, "")));
+  }
+  fprintf(stdout, "\nbenchmark over %ld files:\n", nfiles);
+  fprintf(stdout, "%-20s %10s %10s %12s %10s %10s\n", "profile", "seconds", "files/s", "ms/frame", "words", "masked");
+  for (int i = 0; i < results.size(); i++) {
+    const runstatistics &s = results[i].second;
+    fprintf(stdout, "%-20s %10.2f %10.2f %12.1f %10d %10d\n", results[i].first.c_str(), s.seconds, s.seconds > 0 ? nfiles / s.seconds : 0.0,
+            s.ocrFrames > 0 ? 1000.0 * s.ocrSeconds / s.ocrFrames : 0.0, s.wordsFound, s.wordsMasked);
+  }
 }
 
 struct Arg : public option::Arg {
@@ -658,7 +3803,7 @@ struct Arg : public option::Arg {
   static option::ArgStatus Empty(const option::Option &option, bool) { return (option.arg == 0 || option.arg[0] == 0) ? option::ARG_OK : option::ARG_IGNORE; }
 };
 
-enum optionIndex { UNKNOWN, HELP, INPUT, OUTPUT, NUMTHREADS, CONFIDENCE, STOREMAPPING };
+enum optionIndex { UNKNOWN, HELP, INPUT, OUTPUT, NUMTHREADS, CONFIDENCE, STOREMAPPING, FRAMEWINDOW, TEMPORAL, BANDHASH, TILESIZE, TEXTHEIGHT, CROP, USREGIONS, ANATOMY, COLORKEY, BINARIZE, GATE, PARANOID, PROPOSALS, LAYOUT, MOSAIC, SERIESLEARN, SERIESBAND, SERIESRECHECK, TEMPLATES, TEMPLATEFAST, TEMPLATEBAND, GLYPHS, DETECTORS, PROPAGATE, CACHE, REPLAY, AUDIT, OCRPROFILES, OCRPROFILE, BENCHMARK, OMPTHREADS, CORES, SCALING };
 const option::Descriptor usage[] = {{UNKNOWN, 0, "", "", option::Arg::None,
                                      "USAGE: rewritepixel [options]\n\n"
                                      "Options:"},
@@ -670,6 +3815,99 @@ const option::Descriptor usage[] = {{UNKNOWN, 0, "", "", option::Arg::None,
                                     {CONFIDENCE, 0, "c", "confidence", Arg::Required, "  --confidence, -c  \tConfidence threshold (0..100)."},
                                     {NUMTHREADS, 0, "t", "numthreads", Arg::Required, "  --numthreads, -t  \tHow many threads should be used (default 4)."},
                                     {STOREMAPPING, 0, "m", "storemapping", Arg::Required, "  --storemapping, -m  \tStore the detected strings as a JSON file."},
+                                    {FRAMEWINDOW, 0, "w", "framewindow", Arg::Required,
+                                     "  --framewindow, -w  \tNumber of frames of a multi-frame image decoded at the same time (default 1). "
+                                     "This bounds only the scratch memory of the decoder, the output pixel data always holds all frames."},
+                                    {TEMPORAL, 0, "", "temporal", Arg::None,
+                                     "  --temporal  \tMulti-frame images: detect static text using statistics over all frames, run OCR once "
+                                     "and mask every frame."},
+                                    {BANDHASH, 0, "", "bandhash", Arg::Required,
+                                     "  --bandhash  \tMulti-frame images: re-use the OCR result of an earlier frame if the border bands (fraction of "
+                                     "the image size, e.g. 0.2) and the known text regions did not change."},
+                                    {TILESIZE, 0, "", "tilesize", Arg::Required,
+                                     "  --tilesize  \tSplit images larger than this (in pixel) into overlapping tiles that are recognized in "
+                                     "parallel by idle OCR engines."},
+                                    {TEXTHEIGHT, 0, "", "textheight", Arg::Required,
+                                     "  --textheight  \tDownscale images with large text before OCR so that the text is about this high (in "
+                                     "pixel, e.g. 24)."},
+                                    {CROP, 0, "", "crop", Arg::None, "  --crop  \tRun OCR only on the content inside a black surround (and on separate content islands)."},
+                                    {USREGIONS, 0, "", "usregions", Arg::Required,
+                                     "  --usregions  \tUltrasound: run OCR only outside the SequenceOfUltrasoundRegions and on this fraction "
+                                     "inside of each region (e.g. 0.1)."},
+                                    {ANATOMY, 0, "", "anatomy", Arg::None,
+                                     "  --anatomy  \tCT/MR/CR: exclude the large central body region from OCR, only the remaining content is "
+                                     "recognized."},
+                                    {COLORKEY, 0, "", "colorkey", Arg::None,
+                                     "  --colorkey  \tRGB/YBR: run OCR only on the annotation layer (saturated colors and white)."},
+                                    {BINARIZE, 0, "", "binarize", Arg::Required,
+                                     "  --binarize  \tBinarize images before OCR with \"otsu\" or \"sauvola\", per modality as "
+                                     "\"CT:sauvola,US:otsu\"."},
+                                    {GATE, 0, "", "gate", Arg::Required,
+                                     "  --gate  \tSkip OCR for images with fewer thin text-like strokes in every band of rows (e.g. 20). "
+                                     "Decisions are logged with \"gate:\"."},
+                                    {PARANOID, 0, "", "paranoid", Arg::None, "  --paranoid  \tUse a much more sensitive text gate."},
+                                    {PROPOSALS, 0, "", "proposals", Arg::None,
+                                     "  --proposals  \tRun OCR only on candidate text regions found by a fast text detector, the regions "
+                                     "are shared by idle OCR engines."},
+                                    {LAYOUT, 0, "", "layout", Arg::None,
+                                     "  --layout  \tMask every word found by the layout analysis, run text recognition only on words "
+                                     "short enough to be on the safe list (faster, masks more)."},
+                                    {MOSAIC, 0, "", "mosaic", Arg::Required,
+                                     "  --mosaic  \tImages up to this size (e.g. 256) are recognized together in one large mosaic "
+                                     "image per modality. Not for images that use the gate, detectors, glyphs, ultrasound regions, "
+                                     "series, templates, binarize, crop, anatomy, colorkey, layout, proposals, textheight or tilesize; "
+                                     "the OCR cache is not used for batched images."},
+                                    {SERIESLEARN, 0, "", "serieslearn", Arg::Required,
+                                     "  --serieslearn  \tAfter this many instances of a series only the regions where text was found "
+                                     "before and the border bands are OCR'd."},
+                                    {SERIESBAND, 0, "", "seriesband", Arg::Required,
+                                     "  --seriesband  \tSize of the border bands for --serieslearn relative to the image (default 0.1)."},
+                                    {SERIESRECHECK, 0, "", "seriesrecheck", Arg::Required,
+                                     "  --seriesrecheck  \tFull OCR on every n-th instance of a learned series (default 10, 0: never)."},
+                                    {TEMPLATES, 0, "", "templates", Arg::Required,
+                                     "  --templates  \tJSON file with the text regions learned per device (manufacturer, model, software "
+                                     "version, image size), updated after each run."},
+                                    {TEMPLATEFAST, 0, "", "templatefast", Arg::None,
+                                     "  --templatefast  \tMask the template regions of known devices without OCR, only the border bands "
+                                     "outside of them are OCR'd. A region is masked once text was found in it in 3 instances. New text in the "
+                                     "center of the image is never found."},
+                                    {TEMPLATEBAND, 0, "", "templateband", Arg::Required,
+                                     "  --templateband  \tSize of the border bands OCR'd for known devices (fraction of the image, "
+                                     "default 0.1)."},
+                                    {GLYPHS, 0, "", "glyphs", Arg::Required,
+                                     "  --glyphs  \tJSON file from device key prefix (manufacturer|model|software|rows|columns) to a "
+                                     "directory of glyph bitmaps, these devices use glyph matching instead of OCR (frames without a "
+                                     "matching glyph are OCR'd)."},
+                                    {DETECTORS, 0, "", "detectors", Arg::Required,
+                                     "  --detectors  \tCascade of text detectors (gate, proposals, glyphs, tesseract), per modality as "
+                                     "\"US:gate+glyphs+tesseract,CT:tesseract\"."},
+                                    {PROPAGATE, 0, "", "propagate", Arg::None,
+                                     "  --propagate  \tWords that match the patient name, ids or birth date are searched as bitmaps in "
+                                     "the other images of the study and masked where OCR misses them. The input is sorted by study."},
+                                    {CACHE, 0, "", "cache", Arg::Required,
+                                     "  --cache  \tDirectory for cached OCR results, a re-run with another confidence or safe list "
+                                     "does not need OCR again."},
+                                    {REPLAY, 0, "", "replay", Arg::Required,
+                                     "  --replay  \tMask exactly the boxes of a mapping file (--storemapping, possibly edited) "
+                                     "without OCR, entries with \"masked\": false are skipped."},
+                                    {AUDIT, 0, "", "audit", Arg::Required,
+                                     "  --audit  \tDetection only, append the findings and timing of each file as a JSON line to "
+                                     "this file. Nothing is masked or written."},
+                                    {OCRPROFILES, 0, "", "ocrprofiles", Arg::Required,
+                                     "  --ocrprofiles  \tJSON file with named OCR profiles (languages, tessdata, oem, psm, resolution, "
+                                     "variables)."},
+                                    {OCRPROFILE, 0, "", "ocrprofile", Arg::Required,
+                                     "  --ocrprofile  \tOCR profile to use, per modality as \"US:sparse,CT:fast\"."},
+                                    {BENCHMARK, 0, "", "benchmark", Arg::None,
+                                     "  --benchmark  \tProcess the input once with each OCR profile and report throughput and "
+                                     "detections (output is overwritten)."},
+                                    {OMPTHREADS, 0, "", "ompthreads", Arg::Required,
+                                     "  --ompthreads  \tOpenMP threads inside each OCR engine (default: cores divided by the number of "
+                                     "threads), the program restarts with OMP_THREAD_LIMIT set to this."},
+                                    {CORES, 0, "", "cores", Arg::Required, "  --cores  \tNumber of cores to use for all threads (default: all)."},
+                                    {SCALING, 0, "", "scaling", Arg::None,
+                                     "  --scaling  \tProcess the input with different splits of the cores into threads and OCR threads "
+                                     "and report the throughput (output is overwritten)."},
                                     {UNKNOWN, 0, "", "", Arg::None,
                                      "\nExamples:\n"
                                      "  rewritepixel --input directory --output directory\n"
@@ -706,6 +3944,9 @@ std::vector<std::string> listFiles(const std::string &path, std::vector<std::str
 }
 
 int main(int argc, char *argv[]) {
+  // the full command line to start the program again
+  const int commandlinec = argc;
+  char **commandline = argv;
 
   argc -= (argc > 0);
   argv += (argc > 0); // skip program name argv[0] if present
@@ -729,8 +3970,12 @@ int main(int argc, char *argv[]) {
   std::string input;
   std::string output;
   int numthreads = 4;
-  float confidence = 0.0f; // no confidence is ok
+  processingoptions opts; // no confidence is ok
   std::string storeMappingAsJSON = "";
+  bool benchmark = false;
+  bool scaling = false;
+  int cores = std::max(1u, std::thread::hardware_concurrency());
+  opts.ompThreads = 0;
   for (int i = 0; i < parse.optionsCount(); ++i) {
     option::Option &opt = buffer[i];
     switch (opt.index()) {
@@ -766,7 +4011,7 @@ int main(int argc, char *argv[]) {
       case CONFIDENCE:
         if (opt.arg) {
           fprintf(stdout, "--confidence %f\n", atof(opt.arg));
-          confidence = atoi(opt.arg);
+          opts.confidence = atoi(opt.arg);
         } else {
           fprintf(stdout, "--confidence needs an integer specified (0..100)\n");
           exit(-1);
@@ -781,6 +4026,262 @@ int main(int argc, char *argv[]) {
           exit(-1);
         }
         break;
+      case FRAMEWINDOW:
+        if (opt.arg) {
+          fprintf(stdout, "--framewindow %d\n", atoi(opt.arg));
+          opts.framewindow = atoi(opt.arg);
+        } else {
+          fprintf(stdout, "--framewindow needs an integer specified\n");
+          exit(-1);
+        }
+        break;
+      case TEMPORAL:
+        fprintf(stdout, "--temporal\n");
+        opts.temporal = true;
+        break;
+      case BANDHASH:
+        if (opt.arg) {
+          fprintf(stdout, "--bandhash %f\n", atof(opt.arg));
+          opts.bandHash = atof(opt.arg);
+        } else {
+          fprintf(stdout, "--bandhash needs a fraction of the image size specified (0..0.5)\n");
+          exit(-1);
+        }
+        break;
+      case TILESIZE:
+        if (opt.arg) {
+          fprintf(stdout, "--tilesize %d\n", atoi(opt.arg));
+          opts.tilesize = atoi(opt.arg);
+        } else {
+          fprintf(stdout, "--tilesize needs an integer specified\n");
+          exit(-1);
+        }
+        break;
+      case TEXTHEIGHT:
+        if (opt.arg) {
+          fprintf(stdout, "--textheight %d\n", atoi(opt.arg));
+          opts.textHeight = atoi(opt.arg);
+        } else {
+          fprintf(stdout, "--textheight needs an integer specified\n");
+          exit(-1);
+        }
+        break;
+      case CROP:
+        fprintf(stdout, "--crop\n");
+        opts.crop = true;
+        break;
+      case USREGIONS:
+        if (opt.arg) {
+          fprintf(stdout, "--usregions %f\n", atof(opt.arg));
+          opts.usRegionsInside = std::max(0.0, atof(opt.arg));
+        } else {
+          fprintf(stdout, "--usregions needs a fraction specified (0..0.5)\n");
+          exit(-1);
+        }
+        break;
+      case ANATOMY:
+        fprintf(stdout, "--anatomy\n");
+        opts.anatomy = true;
+        break;
+      case COLORKEY:
+        fprintf(stdout, "--colorkey\n");
+        opts.colorKey = true;
+        break;
+      case BINARIZE:
+        if (opt.arg) {
+          fprintf(stdout, "--binarize %s\n", opt.arg);
+          opts.binarizeByModality = ParseModalityOption(opt.arg);
+        } else {
+          fprintf(stdout, "--binarize needs a method specified (otsu, sauvola)\n");
+          exit(-1);
+        }
+        break;
+      case GATE:
+        if (opt.arg) {
+          fprintf(stdout, "--gate %f\n", atof(opt.arg));
+          opts.gate = atof(opt.arg);
+        } else {
+          fprintf(stdout, "--gate needs a number of strokes specified\n");
+          exit(-1);
+        }
+        break;
+      case PARANOID:
+        fprintf(stdout, "--paranoid\n");
+        opts.paranoid = true;
+        break;
+      case PROPOSALS:
+        fprintf(stdout, "--proposals\n");
+        opts.proposals = true;
+        break;
+      case LAYOUT:
+        fprintf(stdout, "--layout\n");
+        opts.layout = true;
+        break;
+      case MOSAIC:
+        if (opt.arg) {
+          fprintf(stdout, "--mosaic %d\n", atoi(opt.arg));
+          opts.mosaic = atoi(opt.arg);
+        } else {
+          fprintf(stdout, "--mosaic needs an image size specified\n");
+          exit(-1);
+        }
+        break;
+      case SERIESLEARN:
+        if (opt.arg) {
+          fprintf(stdout, "--serieslearn %d\n", atoi(opt.arg));
+          opts.seriesLearn = atoi(opt.arg);
+        } else {
+          fprintf(stdout, "--serieslearn needs a number of instances specified\n");
+          exit(-1);
+        }
+        break;
+      case SERIESBAND:
+        if (opt.arg) {
+          fprintf(stdout, "--seriesband %f\n", atof(opt.arg));
+          opts.seriesBand = atof(opt.arg);
+        } else {
+          fprintf(stdout, "--seriesband needs a fraction specified\n");
+          exit(-1);
+        }
+        break;
+      case SERIESRECHECK:
+        if (opt.arg) {
+          fprintf(stdout, "--seriesrecheck %d\n", atoi(opt.arg));
+          opts.seriesRecheck = atoi(opt.arg);
+        } else {
+          fprintf(stdout, "--seriesrecheck needs a number of instances specified\n");
+          exit(-1);
+        }
+        break;
+      case TEMPLATES:
+        if (opt.arg) {
+          fprintf(stdout, "--templates %s\n", opt.arg);
+          opts.templates = opt.arg;
+        } else {
+          fprintf(stdout, "--templates needs a file name specified\n");
+          exit(-1);
+        }
+        break;
+      case TEMPLATEFAST:
+        fprintf(stdout, "--templatefast\n");
+        opts.templateFast = true;
+        break;
+      case TEMPLATEBAND:
+        if (opt.arg) {
+          fprintf(stdout, "--templateband %f\n", atof(opt.arg));
+          opts.templateBand = atof(opt.arg);
+        } else {
+          fprintf(stdout, "--templateband needs a fraction specified\n");
+          exit(-1);
+        }
+        break;
+      case GLYPHS:
+        if (opt.arg) {
+          fprintf(stdout, "--glyphs %s\n", opt.arg);
+          if (!LoadGlyphFonts(opt.arg))
+            exit(-1);
+        } else {
+          fprintf(stdout, "--glyphs needs a file name specified\n");
+          exit(-1);
+        }
+        break;
+      case DETECTORS:
+        if (opt.arg) {
+          fprintf(stdout, "--detectors %s\n", opt.arg);
+          opts.detectorsByModality = ParseModalityOption(opt.arg);
+          for (std::map<std::string, std::string>::const_iterator it = opts.detectorsByModality.begin(); it != opts.detectorsByModality.end(); ++it) {
+            std::stringstream ss(it->second);
+            std::string name;
+            while (std::getline(ss, name, '+')) {
+              textdetector *detector = CreateDetector(name);
+              if (detector == NULL) {
+                fprintf(stdout, "--detectors: unknown detector \"%s\"\n", name.c_str());
+                exit(-1);
+              }
+              delete detector;
+            }
+          }
+        } else {
+          fprintf(stdout, "--detectors needs a cascade specified\n");
+          exit(-1);
+        }
+        break;
+      case PROPAGATE:
+        fprintf(stdout, "--propagate\n");
+        opts.propagate = true;
+        break;
+      case CACHE:
+        if (opt.arg) {
+          fprintf(stdout, "--cache %s\n", opt.arg);
+          opts.cache = opt.arg;
+        } else {
+          fprintf(stdout, "--cache needs a directory specified\n");
+          exit(-1);
+        }
+        break;
+      case REPLAY:
+        if (opt.arg) {
+          fprintf(stdout, "--replay %s\n", opt.arg);
+          opts.replay = opt.arg;
+        } else {
+          fprintf(stdout, "--replay needs a mapping file specified\n");
+          exit(-1);
+        }
+        break;
+      case AUDIT:
+        if (opt.arg) {
+          fprintf(stdout, "--audit %s\n", opt.arg);
+          opts.audit = opt.arg;
+        } else {
+          fprintf(stdout, "--audit needs a file name specified\n");
+          exit(-1);
+        }
+        break;
+      case OCRPROFILES:
+        if (opt.arg) {
+          fprintf(stdout, "--ocrprofiles %s\n", opt.arg);
+          if (!LoadOCRProfiles(opt.arg))
+            exit(-1);
+        } else {
+          fprintf(stdout, "--ocrprofiles needs a file name specified\n");
+          exit(-1);
+        }
+        break;
+      case OCRPROFILE:
+        if (opt.arg) {
+          fprintf(stdout, "--ocrprofile %s\n", opt.arg);
+          opts.ocrProfileByModality = ParseModalityOption(opt.arg);
+        } else {
+          fprintf(stdout, "--ocrprofile needs a profile name specified\n");
+          exit(-1);
+        }
+        break;
+      case BENCHMARK:
+        fprintf(stdout, "--benchmark\n");
+        benchmark = true;
+        break;
+      case OMPTHREADS:
+        if (opt.arg) {
+          fprintf(stdout, "--ompthreads %d\n", atoi(opt.arg));
+          opts.ompThreads = atoi(opt.arg);
+        } else {
+          fprintf(stdout, "--ompthreads needs an integer specified\n");
+          exit(-1);
+        }
+        break;
+      case CORES:
+        if (opt.arg) {
+          fprintf(stdout, "--cores %d\n", atoi(opt.arg));
+          cores = atoi(opt.arg);
+        } else {
+          fprintf(stdout, "--cores needs an integer specified\n");
+          exit(-1);
+        }
+        break;
+      case SCALING:
+        fprintf(stdout, "--scaling\n");
+        scaling = true;
+        break;
       case UNKNOWN:
         // not possible because Arg::Unknown returns ARG_ILLEGAL
         // which aborts the parse with an error
@@ -788,8 +4289,41 @@ int main(int argc, char *argv[]) {
     }
   }
 
+  // the file threads already use the cores, tesseract should not start more threads than are left (a single
+  // input file runs in one file thread)
+  const bool inputIsDirectory = gdcm::System::FileIsDirectory(input.c_str());
+  const int fileThreads = inputIsDirectory ? numthreads : 1;
+  if (opts.ompThreads <= 0)
+    opts.ompThreads = std::max(1, cores / std::max(1, fileThreads));
+  // idle engines can help with the tiles of large images while the cores are not all used
+  opts.maxEngines = std::max(fileThreads, cores / opts.ompThreads);
+#ifdef _OPENMP
+  if (!scaling)
+    RestartWithThreadLimit(commandline, opts.ompThreads);
+  fprintf(stdout, "CPU budget: %d cores, %d threads x %d OCR threads (OpenMP thread limit %d)\n", cores, inputIsDirectory ? numthreads : 1,
+          opts.ompThreads, omp_get_thread_limit());
+#else
+  fprintf(stdout, "CPU budget: %d cores, %d threads (OpenMP not available, set OMP_THREAD_LIMIT for tesseract)\n", cores, numthreads);
+#endif
+  for (std::map<std::string, std::string>::const_iterator it = opts.ocrProfileByModality.begin(); it != opts.ocrProfileByModality.end(); ++it) {
+    if (ocrprofiles.find(it->second) == ocrprofiles.end()) {
+      fprintf(stderr, "Error: unknown OCR profile \"%s\"\n", it->second.c_str());
+      exit(-1);
+    }
+  }
+  // an engine that cannot load its models would find no text at all, stop before anything is written
+  for (std::map<std::string, ocrprofile>::const_iterator it = ocrprofiles.begin(); it != ocrprofiles.end() && opts.replay == ""; ++it) {
+    tesseract::TessBaseAPI *api = CreateEngine(it->second);
+    if (api == NULL) {
+      fprintf(stderr, "Error: OCR profile \"%s\" cannot be used\n", it->first.c_str());
+      exit(-1);
+    }
+    api->End();
+    delete api;
+  }
+
   // Check if user passed in a single directory - parse all files in all sub-directories
-  if (gdcm::System::FileIsDirectory(input.c_str())) {
+  if (inputIsDirectory) {
     std::vector<std::string> files;
     files = listFiles(input.c_str(), files);
 
@@ -809,13 +4343,21 @@ int main(int argc, char *argv[]) {
     }
     if (numthreads > nfiles)
       numthreads = nfiles;
-    ReadFiles(nfiles, filenames, output.c_str(), numthreads, confidence, storeMappingAsJSON);
+    if (scaling)
+      RunScalingBenchmark(nfiles, cores, commandlinec, commandline);
+    else if (benchmark)
+      RunBenchmark(nfiles, filenames, output.c_str(), numthreads, opts);
+    else
+      ReadFiles(nfiles, filenames, output.c_str(), numthreads, opts, storeMappingAsJSON);
     delete[] filenames;
   } else {
     // its a single file, process that
     const char **filenames = new const char *[1];
     filenames[0] = input.c_str();
-    ReadFiles(1, filenames, output.c_str(), 1, confidence, storeMappingAsJSON);
+    if (benchmark)
+      RunBenchmark(1, filenames, output.c_str(), 1, opts);
+    else
+      ReadFiles(1, filenames, output.c_str(), 1, opts, storeMappingAsJSON);
   }
 
   return 0;